@@ -0,0 +1,84 @@
+// Draco round trip of non-manifold meshes: the encoder's point and index
+// counts, which the glTF accessors are written from, must be what the
+// stream decodes to. Edgebreaker splits non-manifold vertices, so they
+// need not be the counts of the input; with keep_point_count they must.
+//   draco_check
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include <draco/compression/decode.h>
+
+#include "draco_encoder.h"
+
+namespace {
+
+// two fans of four triangles that only share their center vertex, plus a
+// fin on one edge of the first fan: one non-manifold vertex, one
+// non-manifold edge
+MeshPrimitive bowtie_fan() {
+    MeshPrimitive primitive;
+    auto add = [&](float x, float y, float z) {
+        primitive.positions.insert(primitive.positions.end(), { x, y, z });
+        primitive.texcoords.insert(primitive.texcoords.end(), { x * 0.25f + 0.5f, y * 0.25f + 0.5f });
+        return (uint32_t)(primitive.vertex_count() - 1);
+    };
+    uint32_t center = add(0, 0, 0);
+    for (float side : { 1.0f, -1.0f }) {
+        uint32_t ring[5];
+        for (int i = 0; i < 5; i++) {
+            float a = (i - 2) * 0.35f;
+            ring[i] = add(side * 2 * std::cos(a), 2 * std::sin(a), 0);
+        }
+        for (int i = 0; i < 4; i++) {
+            if (side > 0)
+                primitive.indices.insert(primitive.indices.end(), { center, ring[i], ring[i + 1] });
+            else
+                primitive.indices.insert(primitive.indices.end(), { center, ring[i + 1], ring[i] });
+        }
+        if (side > 0) {
+            uint32_t fin = add(1, 0, 1);
+            primitive.indices.insert(primitive.indices.end(), { center, ring[2], fin });
+        }
+    }
+    return primitive;
+}
+
+bool check(const MeshPrimitive& primitive, bool keep_point_count) {
+    DracoOptions options;
+    options.keep_point_count = keep_point_count;
+    DracoMesh encoded;
+    if (!encode_draco_mesh(primitive, options, encoded)) {
+        printf("encode failed\n");
+        return false;
+    }
+    draco::DecoderBuffer buffer;
+    buffer.Init((const char*)encoded.data.data(), encoded.data.size());
+    draco::Decoder decoder;
+    auto decoded = decoder.DecodeMeshFromBuffer(&buffer);
+    if (!decoded.ok()) {
+        printf("decode failed: %s\n", decoded.status().error_msg());
+        return false;
+    }
+    std::unique_ptr<draco::Mesh> mesh = std::move(decoded).value();
+    size_t points = mesh->num_points();
+    size_t indices = mesh->num_faces() * 3;
+    bool ok = points == encoded.point_count && indices == encoded.index_count;
+    if (keep_point_count)
+        ok = ok && points == primitive.vertex_count() && indices == primitive.indices.size();
+    printf("%-16s input %zu points %zu indices, accessors %zu/%zu, decoded %zu/%zu%s\n",
+           keep_point_count ? "keep points" : "edgebreaker",
+           primitive.vertex_count(), primitive.indices.size(),
+           encoded.point_count, encoded.index_count, points, indices, ok ? "" : "  MISMATCH");
+    return ok;
+}
+
+}
+
+int main() {
+    MeshPrimitive primitive = bowtie_fan();
+    bool ok = check(primitive, false);
+    ok = check(primitive, true) && ok;
+    return ok ? 0 : 1;
+}
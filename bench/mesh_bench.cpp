@@ -0,0 +1,133 @@
+// Triangle ordering check: ACMR (cache misses per triangle, 16 entry FIFO)
+// of a shuffled planar grid and a shuffled bumpy sphere, as read, after
+// optimize_vertex_cache, and after it with the overdraw cluster sort.
+// Fails when a pass loses or flips a triangle, when the cluster sort
+// leaves the sphere in the plain vertex cache order, or when it costs
+// more than max_overdraw_acmr times the plain ACMR.
+//   mesh_bench [grid size] [sphere rings]
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <algorithm>
+
+#include "mesh_optimize.h"
+
+namespace {
+
+// ACMR bound of the overdraw order against the plain vertex cache order
+const float max_overdraw_acmr = 1.10f;
+
+void shuffle_triangles(MeshPrimitive& primitive, std::mt19937& rng) {
+    std::vector<std::array<uint32_t, 3>> triangles(primitive.indices.size() / 3);
+    for (size_t t = 0; t < triangles.size(); t++) {
+        triangles[t] = { primitive.indices[t * 3], primitive.indices[t * 3 + 1], primitive.indices[t * 3 + 2] };
+    }
+    std::shuffle(triangles.begin(), triangles.end(), rng);
+    primitive.indices.clear();
+    for (auto& t : triangles) primitive.indices.insert(primitive.indices.end(), t.begin(), t.end());
+}
+
+MeshPrimitive grid(int n) {
+    MeshPrimitive primitive;
+    for (int y = 0; y <= n; y++) {
+        for (int x = 0; x <= n; x++) {
+            primitive.positions.insert(primitive.positions.end(), { (float)x, (float)y, 0.0f });
+        }
+    }
+    for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+            uint32_t a = y * (n + 1) + x, b = a + 1, c = a + n + 1, d = c + 1;
+            primitive.indices.insert(primitive.indices.end(), { a, b, d, a, d, c });
+        }
+    }
+    return primitive;
+}
+
+// latitude/longitude sphere with a radial ripple, wound counter-clockwise
+// seen from outside
+MeshPrimitive sphere(int rings) {
+    MeshPrimitive primitive;
+    int segments = rings * 2;
+    const double pi = 3.14159265358979323846;
+    for (int r = 0; r <= rings; r++) {
+        double theta = pi * r / rings;
+        for (int s = 0; s <= segments; s++) {
+            double phi = 2 * pi * s / segments;
+            double radius = 1.0 + 0.1 * std::sin(5 * theta) * std::cos(7 * phi);
+            primitive.positions.insert(primitive.positions.end(), {
+                (float)(radius * std::sin(theta) * std::cos(phi)),
+                (float)(radius * std::sin(theta) * std::sin(phi)),
+                (float)(radius * std::cos(theta)) });
+        }
+    }
+    for (int r = 0; r < rings; r++) {
+        for (int s = 0; s < segments; s++) {
+            uint32_t a = r * (segments + 1) + s, b = a + 1, c = a + segments + 1, d = c + 1;
+            primitive.indices.insert(primitive.indices.end(), { a, c, d, a, d, b });
+        }
+    }
+    return primitive;
+}
+
+// triangles as sorted rotations, equal when the same triangles with the
+// same winding are there
+std::vector<std::array<uint32_t, 3>> triangle_set(const MeshPrimitive& primitive) {
+    std::vector<std::array<uint32_t, 3>> set;
+    for (size_t i = 0; i + 2 < primitive.indices.size(); i += 3) {
+        std::array<uint32_t, 3> t = { primitive.indices[i], primitive.indices[i + 1], primitive.indices[i + 2] };
+        std::rotate(t.begin(), std::min_element(t.begin(), t.end()), t.end());
+        set.push_back(t);
+    }
+    std::sort(set.begin(), set.end());
+    return set;
+}
+
+float acmr(const MeshPrimitive& primitive) {
+    return average_cache_miss_ratio(primitive.indices, primitive.vertex_count(), vertex_cache_size);
+}
+
+// true when the mesh passes; the sphere must also be reordered by the
+// cluster sort
+bool run(const char* name, const MeshPrimitive& input, bool expect_sort) {
+    MeshPrimitive plain = input;
+    auto t0 = std::chrono::steady_clock::now();
+    optimize_vertex_cache(plain, false);
+    auto t1 = std::chrono::steady_clock::now();
+    MeshPrimitive overdraw = input;
+    optimize_vertex_cache(overdraw, true);
+    auto t2 = std::chrono::steady_clock::now();
+
+    auto reference = triangle_set(input);
+    bool kept = triangle_set(plain) == reference && triangle_set(overdraw) == reference;
+    bool sorted = overdraw.indices != plain.indices;
+    float a_in = acmr(input), a_plain = acmr(plain), a_overdraw = acmr(overdraw);
+    bool ok = kept && a_overdraw <= max_overdraw_acmr * a_plain && (sorted || !expect_sort);
+    printf("%-8s %7zu tris  acmr %.3f -> %.3f (%.1f ms), overdraw %.3f (%.1f ms)%s%s%s\n",
+           name, input.indices.size() / 3, a_in,
+           a_plain, std::chrono::duration<double>(t1 - t0).count() * 1e3,
+           a_overdraw, std::chrono::duration<double>(t2 - t1).count() * 1e3,
+           sorted ? ", clusters reordered" : ", order unchanged",
+           kept ? "" : "  TRIANGLES CHANGED",
+           a_overdraw <= max_overdraw_acmr * a_plain ? "" : "  ACMR OVER BOUND");
+    return ok;
+}
+
+}
+
+int main(int argc, char** argv) {
+    int grid_size = argc > 1 ? atoi(argv[1]) : 200;
+    int rings = argc > 2 ? atoi(argv[2]) : 100;
+    std::mt19937 rng(42);
+
+    MeshPrimitive flat = grid(grid_size);
+    shuffle_triangles(flat, rng);
+    MeshPrimitive round = sphere(rings);
+    shuffle_triangles(round, rng);
+
+    bool ok = run("grid", flat, false);
+    ok = run("sphere", round, true) && ok;
+    return ok ? 0 : 1;
+}
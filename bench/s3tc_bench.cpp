@@ -0,0 +1,172 @@
+// S3TC decode microbenchmark: the per-texel decoder fill_4BitImage used
+// before s3tc_decode, against every kernel of s3tc_decode on this cpu, then
+// an oversized texture reduced to 2048: full decode plus the old nearest
+// resize against the fused s3tc_decode_reduced, and the area filter
+// replacing that resize for uncompressed textures.
+//   s3tc_bench [size] [rounds]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "s3tc.h"
+#include "image_resize.h"
+
+namespace {
+
+// the former fill_4BitImage loop, minus osg::Image
+struct Color { int r, g, b; };
+
+Color rgb565(unsigned short c) {
+    return Color{ ((c >> 11) & 0x1F) << 3, ((c >> 5) & 0x3F) << 2, (c & 0x1F) << 3 };
+}
+
+Color mix_color(unsigned short color0, unsigned short color1, Color c0, Color c1, int idx) {
+    Color f{0, 0, 0};
+    if (color0 > color1) {
+        switch (idx) {
+        case 0: f = c0; break;
+        case 1: f = c1; break;
+        case 2: f = Color{ (2 * c0.r + c1.r) / 3, (2 * c0.g + c1.g) / 3, (2 * c0.b + c1.b) / 3 }; break;
+        case 3: f = Color{ (c0.r + 2 * c1.r) / 3, (c0.g + 2 * c1.g) / 3, (c0.b + 2 * c1.b) / 3 }; break;
+        }
+    }
+    else {
+        switch (idx) {
+        case 0: f = c0; break;
+        case 1: f = c1; break;
+        case 2: f = Color{ (c0.r + c1.r) / 2, (c0.g + c1.g) / 2, (c0.b + c1.b) / 2 }; break;
+        case 3: f = Color{ 0, 0, 0 }; break;
+        }
+    }
+    return f;
+}
+
+void legacy_dxt1(std::vector<unsigned char>& out, const unsigned char* data, size_t size, int width) {
+    const unsigned char* p = data;
+    int x_pos = 0, y_pos = 0;
+    for (size_t i = 0; i < size; i += 8) {
+        unsigned short color0, color1;
+        memcpy(&color0, p, 2); p += 2;
+        memcpy(&color1, p, 2); p += 2;
+        Color c0 = rgb565(color0), c1 = rgb565(color1);
+        for (int row = 0; row < 4; row++) {
+            for (int col = 0; col < 4; col++) {
+                Color cf = mix_color(color0, color1, c0, c1, (*p >> (2 * col)) & 3);
+                int pos = (x_pos + col + (y_pos + row) * width) * 3;
+                out[pos] = cf.r; out[pos + 1] = cf.g; out[pos + 2] = cf.b;
+            }
+            p++;
+        }
+        x_pos += 4;
+        if (x_pos >= width) { x_pos = 0; y_pos += 4; }
+    }
+}
+
+// the former resize_Image
+void legacy_resize(std::vector<unsigned char>& buf, int width, int new_w, int new_h) {
+    std::vector<unsigned char> new_buf(new_w * new_h * 3);
+    int scale = width / new_w;
+    for (int row = 0; row < new_h; row++) {
+        for (int col = 0; col < new_w; col++) {
+            int pos = row * new_w + col;
+            int old_pos = (row * width + col) * scale;
+            for (int i = 0; i < 3; i++) new_buf[3 * pos + i] = buf[3 * old_pos + i];
+        }
+    }
+    buf = new_buf;
+}
+
+template<class F>
+double best_of(int rounds, F f) {
+    double best = 1e30;
+    for (int i = 0; i < rounds; i++) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if (t < best) best = t;
+    }
+    return best;
+}
+
+const char* kernel_name(S3tcKernel k) {
+    switch (k) {
+    case S3tcKernel::scalar: return "scalar";
+    case S3tcKernel::sse41: return "sse4.1";
+    case S3tcKernel::avx2: return "avx2";
+    default: return "auto";
+    }
+}
+
+}
+
+int main(int argc, char** argv) {
+    int size = argc > 1 ? atoi(argv[1]) : 4096;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+    double mpix = (double)size * size / 1e6;
+
+    std::mt19937 rng(42);
+    std::vector<unsigned char> blocks((size_t)size * size);     // enough for DXT5
+    for (auto& b : blocks) b = (unsigned char)rng();
+    std::vector<unsigned char> out((size_t)size * size * 4);
+    std::vector<unsigned char> ref((size_t)size * size * 4);
+
+    size_t dxt1_size = (size_t)size * size / 2;
+    double t = best_of(rounds, [&]() { legacy_dxt1(out, blocks.data(), dxt1_size, size); });
+    printf("%-22s %8.2f ms %8.1f Mpix/s\n", "dxt1 rgb  legacy", t * 1e3, mpix / t);
+
+    const S3tcKernel kernels[] = { S3tcKernel::scalar, S3tcKernel::sse41, S3tcKernel::avx2 };
+    const struct { S3tcFormat format; int comp; const char* name; } cases[] = {
+        { S3tcFormat::dxt1, 3, "dxt1 rgb " },
+        { S3tcFormat::dxt1, 4, "dxt1 rgba" },
+        { S3tcFormat::dxt3, 4, "dxt3 rgba" },
+        { S3tcFormat::dxt5, 4, "dxt5 rgba" },
+    };
+    int mismatches = 0;
+    for (auto& c : cases) {
+        size_t bytes = (size_t)size * size / 16 * s3tc_block_size(c.format);
+        s3tc_decode(c.format, blocks.data(), bytes, size, size, ref.data(), c.comp, S3tcKernel::scalar);
+        for (auto k : kernels) {
+            if (!s3tc_kernel_supported(k)) continue;
+            t = best_of(rounds, [&]() {
+                s3tc_decode(c.format, blocks.data(), bytes, size, size, out.data(), c.comp, k);
+            });
+            bool same = memcmp(out.data(), ref.data(), (size_t)size * size * c.comp) == 0;
+            mismatches += !same;
+            printf("%s %-12s %8.2f ms %8.1f Mpix/s%s\n", c.name, kernel_name(k), t * 1e3, mpix / t,
+                   same ? "" : "  MISMATCH");
+        }
+    }
+
+    // 4x the size, reduced back to size
+    int big = size * 4;
+    std::vector<unsigned char> big_blocks((size_t)big * big / 2);
+    for (auto& b : big_blocks) b = (unsigned char)rng();
+    t = best_of(rounds, [&]() {
+        std::vector<unsigned char> rgb((size_t)big * big * 3);
+        s3tc_decode(S3tcFormat::dxt1, big_blocks.data(), big_blocks.size(), big, big, rgb.data(), 3);
+        legacy_resize(rgb, big, size, size);
+    });
+    printf("dxt1 %d -> %d  decode+resize %8.2f ms\n", big, size, t * 1e3);
+    t = best_of(rounds, [&]() {
+        std::vector<unsigned char> rgb((size_t)size * size * 3);
+        s3tc_decode_reduced(S3tcFormat::dxt1, big_blocks.data(), big_blocks.size(), big, big, 4, rgb.data(), 3);
+    });
+    printf("dxt1 %d -> %d  fused         %8.2f ms\n", big, size, t * 1e3);
+
+    std::vector<unsigned char> big_rgb((size_t)big * big * 3);
+    for (auto& b : big_rgb) b = (unsigned char)rng();
+    t = best_of(rounds, [&]() {
+        std::vector<unsigned char> rgb(big_rgb);
+        legacy_resize(rgb, big, size, size);
+    });
+    printf("rgb  %d -> %d  nearest       %8.2f ms\n", big, size, t * 1e3);
+    t = best_of(rounds, [&]() {
+        std::vector<unsigned char> rgb((size_t)size * size * 3);
+        resize_area(big_rgb.data(), big, big, (size_t)big * 3, 3, rgb.data(), size, size);
+    });
+    printf("rgb  %d -> %d  area          %8.2f ms\n", big, size, t * 1e3);
+    return mismatches ? 1 : 0;
+}
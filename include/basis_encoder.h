@@ -0,0 +1,24 @@
+#pragma once
+#include <vector>
+
+#include "image_resize.h"
+
+enum class BasisMode {
+    etc1s,      // small files, lower quality, transcodes to any GPU format
+    uastc,      // near BC7 quality, zstd supercompressed, larger
+};
+
+struct BasisOptions {
+    BasisMode mode = BasisMode::etc1s;
+    int quality = 128;          // ETC1S quality, 1..255
+    bool mipmaps = true;        // full chain generated by the encoder
+    bool srgb = true;           // base color textures
+};
+
+// false when built without the basisu encoder
+bool basis_available();
+
+// Append a Basis Universal KTX2 file (KHR_texture_basisu) of image to out.
+// 1 and 2 channel images are gray, 2 and 4 channel ones keep their alpha.
+// Thread safe, every call runs its own single threaded encoder.
+bool encode_basis_ktx2(const ImageView& image, const BasisOptions& options, std::vector<unsigned char>& out);
@@ -0,0 +1,109 @@
+#pragma once
+#include <deque>
+#include <queue>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+// Blocking FIFO used between pipeline stages.
+// push() waits while the queue holds `capacity` items (0 = unbounded), which
+// is what throttles a fast producer. After close() pushes fail and pop()
+// drains what is left, then returns false.
+template<class T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity = 0) : capacity_(capacity) {}
+
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this]() {
+            return closed_ || capacity_ == 0 || items_.size() < capacity_;
+        });
+        if (closed_) {
+            return false;
+        }
+        items_.push_back(std::move(item));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this]() { return closed_ || !items_.empty(); });
+        if (items_.empty()) {
+            return false;
+        }
+        item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    // non-blocking pop, false if nothing is queued right now
+    bool try_pop(T& item) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (items_.empty()) {
+            return false;
+        }
+        item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+private:
+    std::deque<T> items_;
+    size_t capacity_;
+    bool closed_ = false;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+};
+
+// Unbounded blocking priority queue, pop() returns the item ordered first
+// by Compare (std::priority_queue order: the largest). Same close()
+// semantics as BoundedQueue.
+template<class T, class Compare>
+class PriorityQueue {
+public:
+    bool push(T item) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (closed_) {
+            return false;
+        }
+        items_.push(std::move(item));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this]() { return closed_ || !items_.empty(); });
+        if (items_.empty()) {
+            return false;
+        }
+        // top() is const, the item is moved out right before it is popped
+        item = std::move(const_cast<T&>(items_.top()));
+        items_.pop();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+    }
+
+private:
+    std::priority_queue<T, std::vector<T>, Compare> items_;
+    bool closed_ = false;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+};
@@ -0,0 +1,22 @@
+#pragma once
+#include <map>
+#include <string>
+#include <cstdint>
+
+// Measurements of a conversion run, saved next to the output so the next
+// run into the same directory can schedule with real numbers.
+struct ConversionProfile {
+    double memory_ratio = 0.0;      // peak tile bytes per osgb byte, 0 = unknown
+    uint64_t peak_tile_bytes = 0;   // largest single tile
+    uint64_t peak_budget_bytes = 0; // highest sum of tile reservations
+    uint64_t peak_rss = 0;          // process peak resident set, 0 = unknown
+    std::map<std::string, double> block_seconds;    // stage time per Tile_* block
+};
+
+// profile file inside an output directory
+std::string profile_path(const std::string& out_dir);
+// false when the file is missing or unreadable, profile is left untouched
+bool load_profile(const std::string& path, ConversionProfile& profile);
+bool save_profile(const std::string& path, const ConversionProfile& profile);
+// peak resident set size of this process in bytes, 0 where unsupported
+uint64_t process_peak_rss();
@@ -0,0 +1,32 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+
+#include "tile_mesh.h"
+
+struct DracoOptions {
+    int position_bits = 14;     // quantization bits per attribute, 0 = lossless
+    int normal_bits = 10;
+    int texcoord_bits = 12;
+    int speed = 3;              // encoder speed 0..10, lower compresses better
+    // decode to exactly the primitive's vertices, as the plain accessors
+    // of a fallback must; costs compression on non-manifold meshes
+    bool keep_point_count = false;
+};
+
+// one primitive as a KHR_draco_mesh_compression stream
+struct DracoMesh {
+    std::vector<unsigned char> data;
+    int position = -1;          // unique id of each attribute in the stream, -1 without
+    int normal = -1;
+    int texcoord = -1;
+    size_t point_count = 0;     // vertices and indices the stream decodes to,
+    size_t index_count = 0;     // not necessarily those of the primitive
+};
+
+// false when built without draco
+bool draco_available();
+
+// Edgebreaker-encode the triangles of primitive. Thread safe, every call
+// uses its own encoder.
+bool encode_draco_mesh(const MeshPrimitive& primitive, const DracoOptions& options, DracoMesh& out);
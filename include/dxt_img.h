@@ -3,6 +3,13 @@
 #include <vector>
 #include <osg/Image>
 
-void fill_4BitImage(std::vector<unsigned char>& jpeg_buf, osg::Image* img, int& width, int& height);
+#include "s3tc.h"
+
+// S3TC (DXT1/3/5) format of img, false for any other image
+bool s3tc_image_format(osg::Image* img, S3tcFormat& format);
+// decode an S3TC image to RGB, halved until it fits max_size (see
+// fit_texture_size); jpeg_buf is left empty if the image data is short
+void fill_s3tc_image(std::vector<unsigned char>& jpeg_buf, osg::Image* img, S3tcFormat format,
+                     int max_size, int& width, int& height);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,30 @@
+#ifndef IMAGE_RESIZE_H
+#define IMAGE_RESIZE_H
+#include <cstddef>
+#include <vector>
+
+// 8 bit pixels with comp (1..4) interleaved channels, rows stride bytes
+// apart, so osg images are encoded where they are
+struct ImageView {
+    const unsigned char* data;
+    int width;
+    int height;
+    int comp;
+    size_t stride;
+};
+
+// Area (box) downsampling of 8 bit images with 1..4 interleaved channels:
+// every output pixel is the mean of the source area it covers, for any
+// ratio. Separable, one source row at a time, so only a few float rows are
+// allocated. new_w/new_h must not exceed width/height, src rows are
+// stride bytes apart and dst is tightly packed.
+void resize_area(const unsigned char* src, int width, int height, size_t stride, int comp,
+                 unsigned char* dst, int new_w, int new_h);
+
+// in place on a tightly packed buffer
+void resize_area(std::vector<unsigned char>& buf, int width, int height, int comp, int new_w, int new_h);
+
+// size after halving until both sides fit max_size, power of two sources stay power of two
+void fit_texture_size(int width, int height, int max_size, int& new_w, int& new_h);
+
+#endif
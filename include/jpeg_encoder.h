@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+#include "image_resize.h"
+
+enum class JpegBackend {
+    automatic,  // turbo when built with libjpeg, otherwise stb
+    stb,        // stb_image_write: scalar, baseline huffman tables
+    turbo,      // libjpeg-turbo: SIMD, every option below
+};
+
+enum class JpegSubsampling {
+    automatic,  // 4:2:0 up to quality 90, 4:4:4 above, as stb does
+    s444,
+    s422,
+    s420,
+};
+
+struct JpegOptions {
+    int quality = 100;              // 1..100
+    JpegSubsampling subsampling = JpegSubsampling::automatic;
+    bool progressive = false;
+    bool optimize_huffman = false;  // two passes for per-image huffman tables
+};
+
+// jpeg encoders are stateless and shared by every thread.
+// encode() appends one jpeg file to out: 1 and 2 channel images are gray
+// (the second channel is dropped), 4 channel images lose their alpha.
+// On failure out is left as it was.
+class JpegEncoder {
+public:
+    virtual ~JpegEncoder() = default;
+    virtual bool encode(const ImageView& image, const JpegOptions& options, std::vector<unsigned char>& out) const = 0;
+    virtual const char* name() const = 0;
+};
+
+// false for turbo when built without libjpeg
+bool jpeg_backend_available(JpegBackend backend);
+// the backend's encoder, stb when it is not available; the stb encoder
+// ignores subsampling, progressive and optimize_huffman
+const JpegEncoder& jpeg_encoder(JpegBackend backend);
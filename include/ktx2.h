@@ -0,0 +1,21 @@
+#ifndef KTX2_H
+#define KTX2_H
+#include <vector>
+#include <cstddef>
+
+// one mip level of block-compressed data, level 0 is full resolution
+struct Ktx2Level {
+    const unsigned char* data;
+    size_t size;
+};
+
+// Append a KTX2 file holding BC1 (DXT1) levels exactly as given: no
+// transcoding and no supercompression. alpha selects the punch-through
+// BC1 format, srgb the sRGB transfer function (base color textures).
+bool write_ktx2_bc1(std::vector<unsigned char>& out, int width, int height,
+                    const std::vector<Ktx2Level>& levels, bool alpha, bool srgb = true);
+
+// bytes of one BC1 level of the given size
+size_t bc1_level_size(int width, int height);
+
+#endif
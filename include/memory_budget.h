@@ -0,0 +1,30 @@
+#pragma once
+#include <mutex>
+#include <cstdint>
+#include <condition_variable>
+
+// Byte budget shared by the tiles in flight.
+// Reservations are estimates, acquire() blocks until a new one fits. When
+// nothing is reserved a request is always admitted, so a tile larger than
+// the whole budget runs alone instead of deadlocking.
+class MemoryBudget {
+public:
+    // limit == 0 never blocks, reservations are still counted
+    explicit MemoryBudget(uint64_t limit = 0) : limit_(limit) {}
+
+    void acquire(uint64_t bytes);
+    // move a held reservation to a better estimate, never blocks
+    void resize(uint64_t from, uint64_t to);
+    void release(uint64_t bytes);
+
+    uint64_t limit() const { return limit_; }
+    // highest total reservation seen
+    uint64_t peak();
+
+private:
+    uint64_t limit_;
+    uint64_t used_ = 0;
+    uint64_t peak_ = 0;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
@@ -0,0 +1,24 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "tile_mesh.h"
+
+// post-transform cache the triangle order is tuned for
+static const int vertex_cache_size = 16;
+
+// Reorder the triangles of primitive for the GPU post-transform vertex
+// cache (Tipsify, Sander et al. 2007). Each triangle keeps its winding.
+// With overdraw, the fans are then cut into clusters wherever that costs
+// at most overdraw_threshold times the cache misses, and the clusters
+// are sorted outward facing first so the front surfaces occlude the rest.
+// The primitive ends up a single draw.
+void optimize_vertex_cache(MeshPrimitive& primitive, bool overdraw, float overdraw_threshold = 1.05f);
+
+// Renumber the vertices in the order the indices first use them, so the
+// vertex fetch walks the attribute arrays forward.
+void optimize_vertex_fetch(MeshPrimitive& primitive);
+
+// cache misses per triangle through a FIFO cache of cache_size entries
+float average_cache_miss_ratio(const std::vector<uint32_t>& indices, size_t vertex_count, int cache_size);
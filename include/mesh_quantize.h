@@ -0,0 +1,33 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+#include "tile_mesh.h"
+
+// KHR_mesh_quantization layouts of the mesh attributes. Every output
+// vertex is padded to 4 bytes, the stride glTF requires of vertex buffers.
+
+// One grid for all positions of a tile, the same step on every axis so the
+// node transform keeps normals valid:
+//   position = offset + scale * q / 32767
+// with q the normalized int16 stored, limited to +-(2^(bits-1) - 1).
+struct PositionQuantization {
+    double offset[3] = { 0.0, 0.0, 0.0 };
+    double scale = 1.0;     // node scale
+    double half_extent = 1.0;
+    int bits = 16;
+};
+
+// grid over the bounds min/max of the tile, bits 2..16
+PositionQuantization position_quantization(const double* min, const double* max, int bits);
+
+// x, y, z, 0 per vertex
+void quantize_positions(const std::vector<float>& positions, const PositionQuantization& q,
+                        std::vector<int16_t>& out);
+
+// unit normals as normalized int8 x, y, z, 0 per vertex
+void quantize_normals(const std::vector<float>& normals, std::vector<int8_t>& out);
+
+// texcoords as normalized uint16 u, v; false when one is outside [0, 1]
+// (repeating textures) and needs the float accessor
+bool quantize_texcoords(const std::vector<float>& texcoords, std::vector<uint16_t>& out);
@@ -0,0 +1,16 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+
+// false when built without meshoptimizer
+bool meshopt_available();
+
+// Append the EXT_meshopt_compression ATTRIBUTES stream of count elements
+// of byte_stride bytes (a multiple of 4, at most 256) to out.
+bool meshopt_encode_attributes(const unsigned char* data, size_t count, size_t byte_stride,
+                               std::vector<unsigned char>& out);
+
+// Append the TRIANGLES stream of count indices of index_size bytes (2 or
+// 4) to out, count a multiple of 3.
+bool meshopt_encode_triangles(const unsigned char* data, size_t count, size_t index_size,
+                              std::vector<unsigned char>& out);
@@ -3,6 +3,8 @@
 #include <vector>
 #include <functional>
 #include <filesystem>
+#include "osgb23dtiles.h"
+#include "tile_pipeline.h"
 
 namespace fs = std::filesystem;
 
@@ -22,4 +24,7 @@ double get_geometric_error(double center_y, int lvl);
 
 std::vector<double> box_to_tileset_box(const std::vector<double>& box_v);
 
-void osgb_batch_convert(const fs::path& input, const fs::path& output, double center_x, double center_y, float quality);
\ No newline at end of file
+// scan the LOD trees of every block and print their sizes, converts nothing
+void osgb_batch_scan(const fs::path& input, unsigned jobs = 0);
+
+void osgb_batch_convert(const fs::path& input, const fs::path& output, double center_x, double center_y, const ConversionOptions& options, unsigned jobs = 0, const PipelineOptions& pipeline_options = PipelineOptions());
\ No newline at end of file
@@ -1,9 +1,102 @@
 #pragma once
+#include <map>
+#include <atomic>
+#include <cstdint>
 #include <string>
+
+#include "jpeg_encoder.h"
+#include "basis_encoder.h"
+#include "webp_encoder.h"
+
 struct MeshInfo;
+class ThreadPool;
+class TilePipeline;
+class TextureStore;
+
+enum class TextureFormat {
+    jpeg,       // every texture decoded and re-encoded as jpeg
+    ktx2,       // DXT1 textures copied as BC1 into KTX2, the others jpeg
+    basisu,     // Basis Universal KTX2 with mipmaps, KHR_texture_basisu
+    webp,       // lossy webp, EXT_texture_webp
+};
+
+enum class GeometryCodec {
+    none,       // plain accessors
+    meshopt,    // EXT_meshopt_compression buffer views
+    draco,      // KHR_draco_mesh_compression primitives
+};
+
+struct ConversionOptions {
+    bool pbr_texture = true;
+    float quality = 1.0f;   // jpeg quality, 0..1
+    JpegBackend jpeg_backend = JpegBackend::automatic;
+    JpegSubsampling jpeg_subsampling = JpegSubsampling::automatic;
+    bool jpeg_progressive = false;
+    bool jpeg_optimize = false;     // optimized huffman tables, turbo only
+    int max_lvl = 100;      // skip tiles whose _L level is deeper
+    TextureFormat texture_format = TextureFormat::jpeg;
+    BasisMode basis_mode = BasisMode::etc1s;
+    int basis_quality = 128;        // ETC1S quality, 1..255
+    bool texture_fallback = false;  // also embed a jpeg for viewers without the texture extension
+    bool shared_textures = false;   // every unique texture written once under Data/textures, tiles reference it
+    uint64_t texture_cache_bytes = 256ull << 20;    // encoded textures kept for reuse by later tiles, 0 = none
+    int max_texture_size = 2048;    // textures are halved until both sides fit
+    // _L level -> max texture size from that level down to the next entry,
+    // levels above the first entry use it too; capped by max_texture_size
+    std::map<int, int> lod_texture_size;
+    bool texture_crop = false;      // crop textures to the region their texcoords use
+    bool texture_atlas = false;     // pack the textures of a tile into atlases, one primitive per atlas
+    bool merge_primitives = false;  // one primitive per material and attribute set
+    bool optimize_mesh = false;     // triangles in vertex cache order, vertices in fetch order
+    bool optimize_overdraw = false; // and triangle clusters outward facing first
+    GeometryCodec geometry_codec = GeometryCodec::none;
+    bool geometry_fallback = false; // keep the uncompressed geometry for viewers without the codec extension
+    int draco_position_bits = 14;   // draco quantization per attribute, 0 = lossless
+    int draco_normal_bits = 10;
+    int draco_texcoord_bits = 12;
+    bool quantize = false;          // KHR_mesh_quantization: int16 positions, int8 normals, uint16 texcoords
+    int position_bits = 16;         // position precision, 2..16
+    // _L level -> position bits from that level down to the next entry,
+    // levels above the first entry use it too
+    std::map<int, int> lod_position_bits;
+
+    int texture_size(int lvl) const {
+        if (lod_texture_size.empty()) return max_texture_size;
+        auto it = lod_texture_size.upper_bound(lvl);
+        if (it != lod_texture_size.begin()) --it;
+        return it->second < max_texture_size ? it->second : max_texture_size;
+    }
+
+    int quantize_bits(int lvl) const {
+        if (lod_position_bits.empty()) return position_bits;
+        auto it = lod_position_bits.upper_bound(lvl);
+        if (it != lod_position_bits.begin()) --it;
+        return it->second;
+    }
+};
+
+// counters every tile adds to, read once the conversion is done
+struct ConversionStats {
+    std::atomic<uint64_t> source_draws{0};  // primitive sets read from the osgb files
+    std::atomic<uint64_t> draws{0};         // glTF primitives written
+};
+
+// Everything a conversion job reads lives here, there is no global state
+// left in the converter. Any number of conversions may run concurrently in
+// one process, each with its own context, and one context may be shared by
+// all threads of a job: stats is the only thing tiles write through it, and
+// only with atomic counters.
+struct ConversionContext {
+    ConversionOptions options;
+    ThreadPool* pool = nullptr;     // optional, null converts on the caller's thread
+    TilePipeline* pipeline = nullptr;   // optional staged engine, takes over the per-tile work
+    TextureStore* textures = nullptr;   // optional, encoded textures shared by every tile
+    ConversionStats* stats = nullptr;   // optional
+};
 
 void* osgb23dtile_path(const char* in_path, const char* out_path,
                     double *box, int* len, double x, double y,
-                    int max_lvl, bool pbr_texture, float q);
+                    const ConversionContext& ctx);
 
-bool osgb2glb_buf(std::string path, std::string& glb_buff, MeshInfo& mesh_info);
\ No newline at end of file
+bool osgb2glb_buf(std::string path, std::string& glb_buff, MeshInfo& mesh_info,
+                    const ConversionContext& ctx);
@@ -0,0 +1,35 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+class ThreadPool;
+
+// One osgb file of a block's PagedLOD tree, as seen by the index scan.
+struct LodNode {
+    std::string file_name;
+    int lvl = -1;                   // _L level from the file name
+    uintmax_t file_size = 0;
+    double center[3] = {0.0, 0.0, 0.0};
+    double radius = 0.0;            // bounding sphere of the file's PagedLODs
+    std::vector<std::pair<float, float>> ranges;   // min/max range of each child
+    uint64_t texture_pixels = 0;    // sum of width * height of its textures
+    std::vector<LodNode> children;
+};
+
+// Build the LOD tree of a block without converting it. Only PagedLOD file
+// names, ranges, bounding spheres and texture sizes are collected: external
+// images are never loaded and nothing is smoothed, decoded or encoded, and
+// every node is released as soon as it has been visited.
+LodNode scan_lod_tree(const std::string& file_name, ThreadPool* pool = nullptr);
+
+// totals over a scanned tree
+struct LodStats {
+    size_t files = 0;
+    uintmax_t bytes = 0;
+    uint64_t texture_pixels = 0;
+    int max_lvl = -1;
+};
+
+void accumulate_lod_stats(const LodNode& node, LodStats& stats);
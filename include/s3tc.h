@@ -0,0 +1,42 @@
+#ifndef S3TC_H
+#define S3TC_H
+#include <cstddef>
+
+enum class S3tcFormat {
+    dxt1,       // BC1, opaque
+    dxt1a,      // BC1 with punch-through alpha
+    dxt3,       // BC2, explicit 4 bit alpha
+    dxt5,       // BC3, interpolated alpha
+};
+
+enum class S3tcKernel {
+    automatic,  // best one the cpu supports
+    scalar,
+    sse41,
+    avx2,
+};
+
+// kernel that automatic resolves to on this cpu
+S3tcKernel s3tc_best_kernel();
+bool s3tc_kernel_supported(S3tcKernel kernel);
+
+// bytes of one 4x4 block
+inline size_t s3tc_block_size(S3tcFormat format) {
+    return (format == S3tcFormat::dxt1 || format == S3tcFormat::dxt1a) ? 8 : 16;
+}
+
+// Decode the first level of an S3TC image into tightly packed rows of
+// width pixels, comp 3 (RGB) or 4 (RGBA). Every 4x4 block is expanded at
+// once from its palette. False if size holds fewer blocks than the image.
+bool s3tc_decode(S3tcFormat format, const unsigned char* data, size_t size,
+                 int width, int height, unsigned char* out, int comp,
+                 S3tcKernel kernel = S3tcKernel::automatic);
+
+// Decode reduced by factor (a multiple of 4): every output pixel is the
+// mean of a factor x factor texel area, summed from the block palettes and
+// their index counts. The full resolution image is never built. out holds
+// (width / factor) x (height / factor) pixels.
+bool s3tc_decode_reduced(S3tcFormat format, const unsigned char* data, size_t size,
+                         int width, int height, int factor, unsigned char* out, int comp);
+
+#endif
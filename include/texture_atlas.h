@@ -0,0 +1,29 @@
+#pragma once
+#include <vector>
+
+#include "image_resize.h"
+
+// one image to place, x/y is its top left corner inside the padding
+struct AtlasItem {
+    int width;
+    int height;
+    int atlas = -1;     // -1: did not fit
+    int x = 0;
+    int y = 0;
+};
+
+struct AtlasSize {
+    int width;
+    int height;
+};
+
+// Shelf packing, tallest first, into at most max_atlases atlases no larger
+// than max_size. Every item gets padding pixels around it so mip levels
+// don't bleed across neighbours. Atlas sides are powers of two when
+// max_size allows it.
+std::vector<AtlasSize> pack_atlases(std::vector<AtlasItem>& items, int max_size, int padding, int max_atlases);
+
+// copy a 1 or 3 channel image into an RGB atlas at x/y, its edge pixels
+// repeated into the padding around it
+void blit_padded(const ImageView& src, unsigned char* atlas, int atlas_width, int atlas_height,
+                 int x, int y, int padding);
@@ -0,0 +1,89 @@
+#pragma once
+#include <list>
+#include <map>
+#include <mutex>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+// 128 bit content hash of a source image and its encode settings
+struct TextureKey {
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+
+    bool operator<(const TextureKey& other) const {
+        return hi != other.hi ? hi < other.hi : lo < other.lo;
+    }
+    std::string hex() const;
+};
+
+class TextureHasher {
+public:
+    void add(const void* data, size_t size);
+    template<class T>
+    void add_value(const T& value) { add(&value, sizeof(value)); }
+    TextureKey key() const;
+
+private:
+    void mix(uint64_t word);
+
+    uint64_t a_ = 0x243F6A8885A308D3ull;
+    uint64_t b_ = 0x13198A2E03707344ull;
+    uint64_t size_ = 0;
+};
+
+struct EncodedImage {
+    bool ok = false;                    // false: the encoder failed, callers fall back
+    bool mipmapped = false;
+    std::string mime;
+    std::vector<unsigned char> data;    // empty once written to a shared file
+    std::string file;                   // shared file name in the store directory
+};
+
+// Conversion-wide store of encoded texture images, so an image referenced
+// by several tiles (LOD levels, sibling nodes) is encoded once.
+// get() runs the encoder once per key, concurrent callers of a key being
+// encoded wait for it.
+// With a shared directory every image is written there once and tiles
+// reference the file; without, encoded bytes are kept for the tiles to
+// embed, the least recently used dropped past cache_bytes.
+class TextureStore {
+public:
+    TextureStore(const std::string& shared_dir, uint64_t cache_bytes);
+
+    TextureStore(const TextureStore&) = delete;
+    TextureStore& operator=(const TextureStore&) = delete;
+
+    using Encoder = std::function<bool(EncodedImage&)>;
+    std::shared_ptr<const EncodedImage> get(const TextureKey& key, const std::string& mime, const Encoder& encode);
+
+    bool shared() const { return !dir_.empty(); }
+    // absolute
+    const std::string& dir() const { return dir_; }
+
+    uint64_t encoded();
+    uint64_t reused();
+
+private:
+    using Result = std::shared_future<std::shared_ptr<const EncodedImage>>;
+    struct Slot {
+        Result result;
+        bool ready = false;
+        size_t bytes = 0;
+        std::list<TextureKey>::iterator lru;
+    };
+
+    void write_shared(const TextureKey& key, EncodedImage& image);
+
+    std::string dir_;
+    uint64_t cache_bytes_;
+    std::mutex mutex_;
+    std::map<TextureKey, Slot> slots_;
+    std::list<TextureKey> lru_;         // ready slots, most recently used first
+    uint64_t held_bytes_ = 0;
+    uint64_t encoded_ = 0;
+    uint64_t reused_ = 0;
+};
@@ -0,0 +1,83 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <future>
+#include <thread>
+#include <vector>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+#include <type_traits>
+
+// Work-stealing thread pool.
+// Every worker owns a deque: it pops its own tasks LIFO and, when empty,
+// steals FIFO from the other workers. Tasks posted from inside a worker
+// land on that worker's deque, tasks posted from outside are spread
+// round-robin.
+class ThreadPool {
+public:
+    // threads == 0 uses std::thread::hardware_concurrency()
+    explicit ThreadPool(unsigned threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void post(std::function<void()> task);
+
+    template<class F>
+    auto submit(F&& f) -> std::future<std::invoke_result_t<F>> {
+        using R = std::invoke_result_t<F>;
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+        std::future<R> res = task->get_future();
+        post([task]() { (*task)(); });
+        return res;
+    }
+
+    // run one queued task on the calling thread, false if none was found
+    bool run_pending_task();
+
+    unsigned size() const { return (unsigned)workers_.size(); }
+
+private:
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void worker_loop(unsigned index);
+    bool try_pop(unsigned index, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<TaskQueue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    size_t pending_ = 0;
+    unsigned next_queue_ = 0;
+    bool stop_ = false;
+};
+
+// Fork/join helper on top of ThreadPool.
+// wait() keeps executing queued pool tasks until the group is done, so
+// recursive fork/join from inside a worker never starves the pool.
+// A null pool runs every task inline.
+class TaskGroup {
+public:
+    explicit TaskGroup(ThreadPool* pool) : pool_(pool) {}
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void run(std::function<void()> task);
+    // rethrows the first exception thrown by a task of the group
+    void wait();
+
+private:
+    ThreadPool* pool_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    size_t active_ = 0;
+    std::exception_ptr error_;
+};
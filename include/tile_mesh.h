@@ -0,0 +1,31 @@
+#pragma once
+#include <set>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// One triangle list of a tile as the geometry passes see it, between
+// reading the osg primitive sets and writing the glTF accessors.
+// Every primitive owns the vertices it references. The primitive sets of
+// one osg geometry stay separate draws over its shared vertices, a pass
+// that reorders triangles across them drops draw_ends to make one draw.
+struct MeshPrimitive {
+    std::vector<float> positions;   // x, y, z per vertex
+    std::vector<float> normals;     // x, y, z per vertex, empty without
+    std::vector<float> texcoords;   // u, v per vertex, empty without
+    std::vector<uint32_t> indices;  // three per triangle
+    std::vector<uint32_t> draw_ends;    // end of each draw in indices, empty for one draw
+    int material = -1;              // texture of the tile, -1 untextured
+
+    size_t vertex_count() const { return positions.size() / 3; }
+    size_t draw_count() const { return draw_ends.empty() ? 1 : draw_ends.size(); }
+    size_t byte_size() const {
+        return (positions.size() + normals.size() + texcoords.size()) * sizeof(float)
+            + indices.size() * sizeof(uint32_t);
+    }
+};
+
+// Concatenate the primitives of each material in materials that carry the
+// same attributes into the first of them, indices rebased, each one a
+// single draw. Returns how many primitives were merged away.
+size_t merge_primitives(std::vector<MeshPrimitive>& primitives, const std::set<int>& materials);
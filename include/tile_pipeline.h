@@ -0,0 +1,123 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <climits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "bounded_queue.h"
+#include "tile_writer.h"
+#include "memory_budget.h"
+#include "osgb23dtiles.h"
+
+struct osg_tree;
+
+struct PipelineOptions {
+    unsigned read_threads = 0;      // osgDB reads
+    unsigned build_threads = 0;     // normals, geometry and glTF assembly
+    unsigned encode_threads = 0;    // texture encoding, glb/b3dm serialization
+    unsigned write_threads = 0;     // b3dm output when io_uring is not available
+    unsigned io_depth = 0;          // b3dm files in flight in the writer
+    size_t queue_depth = 0;         // tiles buffered between two stages
+    uint64_t memory_budget = 0;     // bytes of tiles in flight, 0 = unlimited
+    double memory_ratio = 0.0;      // peak tile bytes per osgb byte seen by a previous run
+
+    // fill every field left at 0 from the job count
+    PipelineOptions resolved(unsigned jobs) const;
+};
+
+// Counts the tiles of one block that are still in flight, and the stage
+// time they took.
+class TileLatch {
+public:
+    void add(size_t n = 1);
+    void done();
+    void wait();
+
+    void add_time(double seconds);
+    double seconds();
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    size_t count_ = 0;
+    double seconds_ = 0.0;
+};
+
+// Staged tile engine: read -> build -> encode -> write.
+// Each stage runs on its own threads and stages are linked by bounded
+// queues, so a slow stage throttles the ones feeding it instead of piling up
+// decoded tiles in memory, and disk reads/writes overlap with the CPU work.
+// The read queue only holds file names and is unbounded: the build stage
+// queues the PagedLOD children it discovers there without ever blocking.
+// It is ordered by _L level, coarse first across every submitted block, so
+// the low levels of the whole model are done before the fine ones start,
+// then by the rank given at submit, so the costliest block goes first
+// within a level.
+// The write stage is a TileWriter, io_uring backed where possible.
+// With a memory budget the read stage only admits a tile while its
+// estimated peak fits: first from the osgb size, refined once its textures
+// are known, and the real peak of every tile is measured for the next run.
+class TilePipeline {
+public:
+    TilePipeline(const PipelineOptions& options, const ConversionContext& ctx);
+    ~TilePipeline();
+
+    TilePipeline(const TilePipeline&) = delete;
+    TilePipeline& operator=(const TilePipeline&) = delete;
+
+    // queue one tile and, as they are discovered, its whole subtree into
+    // out_path; latch counts every queued tile until it is written or dropped.
+    // Lower ranks are read first among tiles of the same level.
+    void submit(osg_tree* tree, const std::string& out_path, TileLatch* latch, unsigned rank = 0);
+
+    // Highest level L such that no tile of level <= L is queued or in any
+    // stage, waits until it is above `after`. Returns all_levels once
+    // nothing is in flight. Tree nodes of those levels are final and can be
+    // read while the deeper ones are still converted.
+    static const int all_levels = INT_MAX;
+    int wait_level(int after);
+
+    // peak bytes per osgb byte over the tiles done so far
+    double memory_ratio();
+    uint64_t peak_tile_bytes();
+    uint64_t peak_budget_bytes() { return budget_.peak(); }
+
+private:
+    struct Job;
+    using JobPtr = std::unique_ptr<Job>;
+
+    void read_loop();
+    void build_loop();
+    void encode_loop();
+    void tile_done(TileLatch* latch, int lvl);
+    int completed_level() const;
+    void reserve(Job& job, uint64_t bytes);
+    void record_peak(const Job& job, uint64_t bytes);
+
+    const ConversionContext& ctx_;
+    MemoryBudget budget_;
+    double read_ratio_;
+    std::mutex stats_mutex_;
+    double memory_ratio_ = 0.0;
+    uint64_t peak_tile_bytes_ = 0;
+    struct JobOrder {
+        bool operator()(const JobPtr& a, const JobPtr& b) const;
+    };
+
+    std::mutex level_mutex_;
+    std::condition_variable level_cv_;
+    std::map<int, size_t> levels_;  // tiles in flight per level
+    uint64_t next_seq_ = 0;
+
+    PriorityQueue<JobPtr, JobOrder> read_queue_;
+    BoundedQueue<JobPtr> build_queue_;
+    BoundedQueue<JobPtr> encode_queue_;
+    std::unique_ptr<TileWriter> writer_;
+    std::vector<std::thread> read_threads_;
+    std::vector<std::thread> build_threads_;
+    std::vector<std::thread> encode_threads_;
+};
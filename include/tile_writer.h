@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <functional>
+
+struct WriterOptions {
+    unsigned threads = 1;           // blocking writer threads of the fallback
+    unsigned queue_depth = 64;      // files in flight / queued before write() blocks
+};
+
+// Asynchronous sink for output files.
+// write() takes the buffer, queues it and returns; it only blocks while
+// queue_depth files are already waiting. done(ok) runs on a writer thread
+// once the file is on disk or has failed. Destruction drains every pending
+// write.
+class TileWriter {
+public:
+    virtual ~TileWriter() = default;
+    virtual void write(std::string path, std::string data, std::function<void(bool)> done) = 0;
+};
+
+// io_uring writer (openat/write/close linked into one submission per file)
+// when built with liburing and the running kernel supports it, otherwise a
+// pool of threads calling write_file.
+std::unique_ptr<TileWriter> make_tile_writer(const WriterOptions& options);
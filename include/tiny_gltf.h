@@ -481,6 +481,7 @@ struct Image {
 struct Texture {
   int sampler;
   int source;  // Required (not specified in the spec ?)
+  std::string extensions; // raw json object, e.g. a KTX2 source for the texture
   Value extras;
 
   Texture() : sampler(-1), source(-1) {}
@@ -521,6 +522,7 @@ struct BufferView {
   size_t byteStride;  // minimum 4, maximum 252 (multiple of 4), default 0 =
                       // understood to be tightly packed
   int target = 0;         // ["ARRAY_BUFFER", "ELEMENT_ARRAY_BUFFER"]
+  std::string extensions; // raw json object, e.g. its meshopt compressed copy
   Value extras;
 
   BufferView() : byteOffset(0), byteStride(0) {}
@@ -579,6 +581,7 @@ struct Accessor {
   Accessor() {
     bufferView = -1;
     byteOffset = 0;
+    normalized = false;
   }
 };
 
@@ -637,6 +640,7 @@ struct Primitive {
   // where each target is a dict with attribues in ["POSITION, "NORMAL",
   // "TANGENT"] pointing
   // to their corresponding accessors
+  std::string extensions; // raw json object, e.g. its draco compressed copy
   Value extras;
 
   Primitive() {
@@ -698,6 +702,8 @@ typedef struct {
   std::vector<unsigned char> data;
   std::string
       uri;  // considered as required here but not in the spec (need to clarify)
+  size_t byteLength = 0;  // of a buffer without data, e.g. a meshopt fallback
+  std::string extensions; // raw json object
   Value extras;
 } Buffer;
 
@@ -3362,12 +3368,15 @@ static void SerializeParameterMap(ParameterMap &param, json &o) {
 }
 
 static void SerializeGltfAccessor(Accessor &accessor, json &o) {
-  SerializeNumberProperty<int>("bufferView", accessor.bufferView, o);
+  // accessors of compressed primitives have no buffer view
+  if (accessor.bufferView >= 0)
+    SerializeNumberProperty<int>("bufferView", accessor.bufferView, o);
 
   if (accessor.byteOffset != 0.0)
     SerializeNumberProperty<int>("byteOffset", int(accessor.byteOffset), o);
 
   SerializeNumberProperty<int>("componentType", accessor.componentType, o);
+  if (accessor.normalized) o["normalized"] = true;
   SerializeNumberProperty<size_t>("count", accessor.count, o);
   SerializeNumberArrayProperty<double>("min", accessor.minValues, o);
   SerializeNumberArrayProperty<double>("max", accessor.maxValues, o);
@@ -3475,6 +3484,9 @@ static void SerializeGltfBufferView(BufferView &bufferView,
   if (bufferView.name.size()) {
     SerializeStringProperty("name", bufferView.name, o);
   }
+  if (!bufferView.extensions.empty()) {
+    o["extensions"] = json::parse(bufferView.extensions);
+  }
 }
 
 // Only external textures are serialized for now
@@ -3537,6 +3549,8 @@ static void SerializeGltfMesh(Mesh &mesh, json &o) {
     if (gltfPrimitive.material > -1)
         SerializeNumberProperty<int>("material", gltfPrimitive.material, primitive);
     SerializeNumberProperty<int>("mode", gltfPrimitive.mode, primitive);
+    if (!gltfPrimitive.extensions.empty())
+      primitive["extensions"] = json::parse(gltfPrimitive.extensions);
 
     // Morph targets
     if (gltfPrimitive.targets.size()) {
@@ -3680,7 +3694,13 @@ static void SerializeGltfSkin(Skin &skin, json &o) {
 
 static void SerializeGltfTexture(Texture &texture, json &o) {
   SerializeNumberProperty("sampler", texture.sampler, o);
-  SerializeNumberProperty("source", texture.source, o);
+  // no source when only an extension provides the image
+  if (texture.source >= 0) {
+    SerializeNumberProperty("source", texture.source, o);
+  }
+  if (!texture.extensions.empty()) {
+    o["extensions"] = json::parse(texture.extensions);
+  }
 
   if (texture.extras.Size()) {
     json extras;
@@ -3901,9 +3921,13 @@ std::string TinyGLTF::Serialize(Model *model) {
   json buffers;
   for (unsigned int i = 0; i < model->buffers.size(); ++i) {
     json buffer;
-    SerializeNumberProperty("byteLength", model->buffers[i].data.size(), buffer);
+    size_t byteLength = model->buffers[i].data.empty() ? model->buffers[i].byteLength
+                                                       : model->buffers[i].data.size();
+    SerializeNumberProperty("byteLength", byteLength, buffer);
     if (model->buffers[i].name.size())
       SerializeStringProperty("name", model->buffers[i].name, buffer);
+    if (!model->buffers[i].extensions.empty())
+      buffer["extensions"] = json::parse(model->buffers[i].extensions);
     buffers.push_back(buffer);
   }
   output["buffers"] = buffers;
@@ -3984,8 +4008,8 @@ std::string TinyGLTF::Serialize(Model *model) {
   KHR_techniques_webgl["techniques"] = techniques;
   json extensions = json({});
   extensions["KHR_techniques_webgl"] = KHR_techniques_webgl;
-  // use extension
-  if (model->extensionsUsed.size())
+  // only the shader material has model level extensions
+  if (!model->extensions.KHR_techniques_webgl.techniques.empty())
     output["extensions"] = extensions;
 
   // MESHES
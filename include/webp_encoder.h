@@ -0,0 +1,11 @@
+#pragma once
+#include <vector>
+
+#include "image_resize.h"
+
+// false when built without libwebp
+bool webp_available();
+
+// Append a lossy webp of image (quality 0..100) to out. 1 and 2 channel
+// images are gray, 2 and 4 channel ones keep their alpha.
+bool encode_webp(const ImageView& image, float quality, std::vector<unsigned char>& out);
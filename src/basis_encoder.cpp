@@ -0,0 +1,79 @@
+#include "basis_encoder.h"
+
+#ifdef HAVE_BASISU
+#include <mutex>
+#include <algorithm>
+#include <encoder/basisu_comp.h>
+
+bool basis_available() {
+    return true;
+}
+
+bool encode_basis_ktx2(const ImageView& image, const BasisOptions& options, std::vector<unsigned char>& out) {
+    if (image.comp < 1 || image.comp > 4 || image.width <= 0 || image.height <= 0) {
+        return false;
+    }
+    static std::once_flag init_flag;
+    std::call_once(init_flag, []() { basisu::basisu_encoder_init(); });
+
+    basisu::image source(image.width, image.height);
+    bool alpha = image.comp == 2 || image.comp == 4;
+    for (int y = 0; y < image.height; y++) {
+        const unsigned char* row = image.data + y * image.stride;
+        for (int x = 0; x < image.width; x++) {
+            const unsigned char* p = row + x * image.comp;
+            if (image.comp < 3)
+                source(x, y).set(p[0], p[0], p[0], alpha ? p[1] : 255);
+            else
+                source(x, y).set(p[0], p[1], p[2], alpha ? p[3] : 255);
+        }
+    }
+
+    // the pipeline already runs one tile per thread, the encoder doesn't fan out
+    basisu::job_pool jobs(1);
+    basisu::basis_compressor_params params;
+    params.m_source_images.push_back(source);
+    params.m_read_source_images = false;
+    params.m_write_output_basis_files = false;
+    params.m_status_output = false;
+    params.m_multithreading = false;
+    params.m_pJob_pool = &jobs;
+    params.m_create_ktx2_file = true;
+    params.m_mip_gen = options.mipmaps;
+    params.m_mip_srgb = options.srgb;
+    params.m_perceptual = options.srgb;
+    params.m_ktx2_srgb_transfer_func = options.srgb;
+    params.m_check_for_alpha = false;
+    params.m_force_alpha = alpha;
+    if (options.mode == BasisMode::uastc) {
+        params.m_uastc = true;
+        params.m_pack_uastc_flags = basisu::cPackUASTCLevelDefault;
+        params.m_ktx2_uastc_supercompression = basist::KTX2_SS_ZSTANDARD;
+    }
+    else {
+        params.m_quality_level = std::min(255, std::max(1, options.quality));
+    }
+
+    basisu::basis_compressor compressor;
+    if (!compressor.init(params) || compressor.process() != basisu::basis_compressor::cECSuccess) {
+        return false;
+    }
+    const basisu::uint8_vec& ktx2 = compressor.get_output_ktx2_file();
+    if (ktx2.empty()) {
+        return false;
+    }
+    out.insert(out.end(), ktx2.begin(), ktx2.end());
+    return true;
+}
+
+#else
+
+bool basis_available() {
+    return false;
+}
+
+bool encode_basis_ktx2(const ImageView&, const BasisOptions&, std::vector<unsigned char>&) {
+    return false;
+}
+
+#endif
@@ -0,0 +1,60 @@
+#include "conversion_profile.h"
+
+#include <fstream>
+#include <nlohmann/json.hpp>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "tileset.h"
+
+std::string profile_path(const std::string& out_dir) {
+    return out_dir + "/osgb2tiles_profile.json";
+}
+
+bool load_profile(const std::string& path, ConversionProfile& profile) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    nlohmann::json json = nlohmann::json::parse(in, nullptr, false);
+    if (json.is_discarded() || !json.is_object()) {
+        return false;
+    }
+    profile.memory_ratio = json.value("memory_ratio", 0.0);
+    profile.peak_tile_bytes = json.value("peak_tile_bytes", uint64_t(0));
+    profile.peak_budget_bytes = json.value("peak_budget_bytes", uint64_t(0));
+    profile.peak_rss = json.value("peak_rss", uint64_t(0));
+    if (json.contains("block_seconds") && json["block_seconds"].is_object()) {
+        for (auto& item : json["block_seconds"].items()) {
+            if (item.value().is_number()) {
+                profile.block_seconds[item.key()] = item.value().get<double>();
+            }
+        }
+    }
+    return true;
+}
+
+bool save_profile(const std::string& path, const ConversionProfile& profile) {
+    nlohmann::json json = {
+        {"memory_ratio", profile.memory_ratio},
+        {"peak_tile_bytes", profile.peak_tile_bytes},
+        {"peak_budget_bytes", profile.peak_budget_bytes},
+        {"peak_rss", profile.peak_rss},
+        {"block_seconds", profile.block_seconds}
+    };
+    std::string buf = json.dump(2);
+    return write_file(path.c_str(), buf.data(), buf.size());
+}
+
+uint64_t process_peak_rss() {
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        // ru_maxrss is in KiB on Linux
+        return (uint64_t)usage.ru_maxrss * 1024;
+    }
+#endif
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include "draco_encoder.h"
+
+#ifdef HAVE_DRACO
+#include <draco/compression/encode.h>
+#include <draco/mesh/mesh.h>
+
+bool draco_available() {
+    return true;
+}
+
+// attribute of `components` floats per point, its unique id in the mesh
+static int add_draco_attribute(draco::Mesh& mesh, draco::GeometryAttribute::Type type,
+                               const std::vector<float>& values, int components) {
+    draco::GeometryAttribute attribute;
+    attribute.Init(type, nullptr, components, draco::DT_FLOAT32, false,
+                   sizeof(float) * components, 0);
+    int id = mesh.AddAttribute(attribute, true, mesh.num_points());
+    draco::PointAttribute* added = mesh.attribute(id);
+    for (uint32_t i = 0; i < mesh.num_points(); i++) {
+        added->SetAttributeValue(draco::AttributeValueIndex(i), &values[i * components]);
+    }
+    return added->unique_id();
+}
+
+bool encode_draco_mesh(const MeshPrimitive& primitive, const DracoOptions& options, DracoMesh& out) {
+    if (primitive.indices.size() % 3 != 0 || primitive.vertex_count() == 0) {
+        return false;
+    }
+    draco::Mesh mesh;
+    mesh.set_num_points(primitive.vertex_count());
+    mesh.SetNumFaces(primitive.indices.size() / 3);
+    for (size_t f = 0; f < primitive.indices.size() / 3; f++) {
+        draco::Mesh::Face face;
+        for (int k = 0; k < 3; k++) {
+            face[k] = draco::PointIndex(primitive.indices[f * 3 + k]);
+        }
+        mesh.SetFace(draco::FaceIndex(f), face);
+    }
+    out.position = add_draco_attribute(mesh, draco::GeometryAttribute::POSITION, primitive.positions, 3);
+    if (!primitive.normals.empty())
+        out.normal = add_draco_attribute(mesh, draco::GeometryAttribute::NORMAL, primitive.normals, 3);
+    if (!primitive.texcoords.empty())
+        out.texcoord = add_draco_attribute(mesh, draco::GeometryAttribute::TEX_COORD, primitive.texcoords, 2);
+
+    draco::Encoder encoder;
+    encoder.SetSpeedOptions(options.speed, options.speed);
+    encoder.SetEncodingMethod(draco::MESH_EDGEBREAKER_ENCODING);
+    if (options.position_bits > 0)
+        encoder.SetAttributeQuantization(draco::GeometryAttribute::POSITION, options.position_bits);
+    if (options.normal_bits > 0)
+        encoder.SetAttributeQuantization(draco::GeometryAttribute::NORMAL, options.normal_bits);
+    if (options.texcoord_bits > 0)
+        encoder.SetAttributeQuantization(draco::GeometryAttribute::TEX_COORD, options.texcoord_bits);
+    draco::EncoderBuffer buffer;
+    if (!encoder.EncodeMeshToBuffer(mesh, &buffer).ok()) {
+        return false;
+    }
+    // edgebreaker splits non-manifold vertices, the stream can decode to
+    // more points than the mesh had. The sequential encoder keeps them.
+    if (options.keep_point_count && encoder.num_encoded_points() != mesh.num_points()) {
+        buffer.Clear();
+        encoder.SetEncodingMethod(draco::MESH_SEQUENTIAL_ENCODING);
+        if (!encoder.EncodeMeshToBuffer(mesh, &buffer).ok()) {
+            return false;
+        }
+    }
+    out.data.assign(buffer.data(), buffer.data() + buffer.size());
+    out.point_count = encoder.num_encoded_points();
+    out.index_count = encoder.num_encoded_faces() * 3;
+    return true;
+}
+
+#else
+
+bool draco_available() {
+    return false;
+}
+
+bool encode_draco_mesh(const MeshPrimitive&, const DracoOptions&, DracoMesh&) {
+    return false;
+}
+
+#endif
@@ -0,0 +1,158 @@
+#include "image_resize.h"
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RESIZE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// source taps of one output pixel along an axis
+struct Taps {
+    int first;
+    int count;
+    int offset;     // into the weights array
+};
+
+// area weights for shrinking size to new_size, each output sums to 1
+void area_taps(int size, int new_size, std::vector<Taps>& taps, std::vector<float>& weights) {
+    double scale = (double)size / new_size;
+    taps.resize(new_size);
+    weights.clear();
+    for (int i = 0; i < new_size; i++) {
+        double start = i * scale;
+        double end = std::min((double)size, (i + 1) * scale);
+        int first = (int)start;
+        int last = std::min(size - 1, (int)std::ceil(end) - 1);
+        taps[i] = Taps{first, last - first + 1, (int)weights.size()};
+        for (int s = first; s <= last; s++) {
+            double overlap = std::min(end, s + 1.0) - std::max(start, (double)s);
+            weights.push_back((float)(overlap / scale));
+        }
+    }
+}
+
+// one source row reduced horizontally into new_w * comp floats
+void horizontal(const unsigned char* row, int comp, const std::vector<Taps>& taps,
+                const std::vector<float>& weights, float* out, int row_bytes) {
+    int new_w = (int)taps.size();
+#ifdef RESIZE_SSE2
+    if (comp == 4 || comp == 3) {
+        // one pixel per vector, a 4 byte load also for RGB while it stays in the row
+        const __m128i zero = _mm_setzero_si128();
+        for (int x = 0; x < new_w; x++) {
+            const Taps& t = taps[x];
+            const float* w = &weights[t.offset];
+            __m128 acc = _mm_setzero_ps();
+            int s = 0;
+            for (; s < t.count && (t.first + s) * comp + 4 <= row_bytes; s++) {
+                int px;
+                const unsigned char* p = row + (t.first + s) * comp;
+                px = p[0] | p[1] << 8 | p[2] << 16 | (comp == 4 ? p[3] << 24 : 0);
+                __m128i v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(px), zero), zero);
+                acc = _mm_add_ps(acc, _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(w[s])));
+            }
+            float lanes[4];
+            _mm_storeu_ps(lanes, acc);
+            for (; s < t.count; s++) {
+                const unsigned char* p = row + (t.first + s) * comp;
+                for (int c = 0; c < comp; c++) lanes[c] += p[c] * w[s];
+            }
+            for (int c = 0; c < comp; c++) out[x * comp + c] = lanes[c];
+        }
+        return;
+    }
+#endif
+    for (int x = 0; x < new_w; x++) {
+        const Taps& t = taps[x];
+        const float* w = &weights[t.offset];
+        for (int c = 0; c < comp; c++) {
+            float acc = 0.0f;
+            for (int s = 0; s < t.count; s++) {
+                acc += row[(t.first + s) * comp + c] * w[s];
+            }
+            out[x * comp + c] = acc;
+        }
+    }
+}
+
+// acc += row * weight over n floats
+void accumulate(float* acc, const float* row, float weight, int n) {
+    int i = 0;
+#ifdef RESIZE_SSE2
+    const __m128 w = _mm_set1_ps(weight);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(_mm_loadu_ps(row + i), w)));
+    }
+#endif
+    for (; i < n; i++) acc[i] += row[i] * weight;
+}
+
+// round and clamp n floats to bytes
+void store_bytes(const float* acc, unsigned char* dst, int n) {
+    int i = 0;
+#ifdef RESIZE_SSE2
+    const __m128 half = _mm_set1_ps(0.5f);
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(acc + i), half));
+        __m128i b = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(acc + i + 4), half));
+        __m128i words = _mm_packs_epi32(a, b);
+        _mm_storel_epi64((__m128i*)(dst + i), _mm_packus_epi16(words, words));
+    }
+#endif
+    for (; i < n; i++) {
+        float v = acc[i] + 0.5f;
+        dst[i] = (unsigned char)std::min(255.0f, std::max(0.0f, v));
+    }
+}
+
+}
+
+void resize_area(const unsigned char* src, int width, int height, size_t stride, int comp,
+                 unsigned char* dst, int new_w, int new_h) {
+    if (new_w == width && new_h == height) {
+        for (int y = 0; y < height; y++) {
+            std::copy(src + y * stride, src + y * stride + (size_t)width * comp, dst + (size_t)y * width * comp);
+        }
+        return;
+    }
+    std::vector<Taps> x_taps, y_taps;
+    std::vector<float> x_weights, y_weights;
+    area_taps(width, new_w, x_taps, x_weights);
+    area_taps(height, new_h, y_taps, y_weights);
+
+    int n = new_w * comp;
+    std::vector<float> row(n), acc(n);
+    int cached = -1;    // source row held in row, shared by neighbouring outputs
+    for (int y = 0; y < new_h; y++) {
+        const Taps& t = y_taps[y];
+        std::fill(acc.begin(), acc.end(), 0.0f);
+        for (int s = 0; s < t.count; s++) {
+            int sy = t.first + s;
+            if (sy != cached) {
+                horizontal(src + sy * stride, comp, x_taps, x_weights, row.data(), width * comp);
+                cached = sy;
+            }
+            accumulate(acc.data(), row.data(), y_weights[t.offset + s], n);
+        }
+        store_bytes(acc.data(), dst + (size_t)y * n, n);
+    }
+}
+
+void resize_area(std::vector<unsigned char>& buf, int width, int height, int comp, int new_w, int new_h) {
+    std::vector<unsigned char> out((size_t)new_w * new_h * comp);
+    resize_area(buf.data(), width, height, (size_t)width * comp, comp, out.data(), new_w, new_h);
+    buf.swap(out);
+}
+
+void fit_texture_size(int width, int height, int max_size, int& new_w, int& new_h) {
+    new_w = width;
+    new_h = height;
+    while ((new_w > max_size || new_h > max_size) && new_w > 1 && new_h > 1) {
+        new_w /= 2;
+        new_h /= 2;
+    }
+}
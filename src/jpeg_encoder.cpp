@@ -0,0 +1,214 @@
+#include "jpeg_encoder.h"
+
+#include <cstring>
+#include <algorithm>
+
+#include "stb_image_write.h"
+
+#ifdef HAVE_LIBJPEG
+#include <csetjmp>
+#include <cstdio>
+#include <jpeglib.h>
+#ifndef JCS_EXTENSIONS
+#error "HAVE_LIBJPEG needs libjpeg-turbo, jpeglib.h has no JCS_EXTENSIONS"
+#endif
+#endif
+
+namespace {
+
+void append_to_vector(void* context, void* data, int len) {
+    auto out = (std::vector<unsigned char>*)context;
+    out->insert(out->end(), (unsigned char*)data, (unsigned char*)data + len);
+}
+
+class StbJpegEncoder : public JpegEncoder {
+public:
+    bool encode(const ImageView& image, const JpegOptions& options, std::vector<unsigned char>& out) const override {
+        if (image.comp < 1 || image.comp > 4) {
+            return false;
+        }
+        // stb only takes tightly packed rows
+        const unsigned char* data = image.data;
+        std::vector<unsigned char> packed;
+        size_t row_size = (size_t)image.width * image.comp;
+        if (image.stride != row_size) {
+            packed.resize(row_size * image.height);
+            for (int y = 0; y < image.height; y++) {
+                memcpy(&packed[y * row_size], image.data + y * image.stride, row_size);
+            }
+            data = packed.data();
+        }
+        size_t start = out.size();
+        if (!stbi_write_jpg_to_func(append_to_vector, &out, image.width, image.height, image.comp, data, options.quality)) {
+            out.resize(start);
+            return false;
+        }
+        return true;
+    }
+
+    const char* name() const override { return "stb"; }
+};
+
+#ifdef HAVE_LIBJPEG
+
+// channels 0..2, or channel 0 for gray, of every pixel in a row
+void pack_row(const unsigned char* src, int width, int comp, int out_comp, unsigned char* dst) {
+    for (int x = 0; x < width; x++) {
+        for (int c = 0; c < out_comp; c++) {
+            dst[x * out_comp + c] = src[x * comp + c];
+        }
+    }
+}
+
+struct ErrorManager {
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+void error_exit(j_common_ptr cinfo) {
+    longjmp(((ErrorManager*)cinfo->err)->jump, 1);
+}
+
+void output_message(j_common_ptr) {
+}
+
+// compressed data goes straight into the output vector, grown as needed
+struct VectorDestination {
+    jpeg_destination_mgr pub;
+    std::vector<unsigned char>* out;
+    size_t initial;
+};
+
+void init_destination(j_compress_ptr cinfo) {
+    auto dest = (VectorDestination*)cinfo->dest;
+    size_t used = dest->out->size();
+    dest->out->resize(used + dest->initial);
+    dest->pub.next_output_byte = dest->out->data() + used;
+    dest->pub.free_in_buffer = dest->initial;
+}
+
+boolean empty_output_buffer(j_compress_ptr cinfo) {
+    // called with the whole free space used
+    auto dest = (VectorDestination*)cinfo->dest;
+    size_t used = dest->out->size();
+    size_t grow = std::max<size_t>(used / 2, 4096);
+    dest->out->resize(used + grow);
+    dest->pub.next_output_byte = dest->out->data() + used;
+    dest->pub.free_in_buffer = grow;
+    return TRUE;
+}
+
+void term_destination(j_compress_ptr cinfo) {
+    auto dest = (VectorDestination*)cinfo->dest;
+    dest->out->resize(dest->out->size() - dest->pub.free_in_buffer);
+}
+
+class TurboJpegEncoder : public JpegEncoder {
+public:
+    bool encode(const ImageView& image, const JpegOptions& options, std::vector<unsigned char>& out) const override {
+        if (image.comp < 1 || image.comp > 4 || image.width <= 0 || image.height <= 0) {
+            return false;
+        }
+        size_t start = out.size();
+        // rows libjpeg can't take as they are are repacked one at a time
+        std::vector<unsigned char> row;
+        if (!compress(image, options, out, row)) {
+            out.resize(start);
+            return false;
+        }
+        return true;
+    }
+
+    const char* name() const override { return "turbo"; }
+
+private:
+    // no objects with destructors in here, errors longjmp back to setjmp
+    static bool compress(const ImageView& image, const JpegOptions& options,
+                         std::vector<unsigned char>& out, std::vector<unsigned char>& row) {
+        jpeg_compress_struct cinfo;
+        ErrorManager err;
+        VectorDestination dest;
+        cinfo.err = jpeg_std_error(&err.pub);
+        err.pub.error_exit = error_exit;
+        err.pub.output_message = output_message;
+        if (setjmp(err.jump)) {
+            jpeg_destroy_compress(&cinfo);
+            return false;
+        }
+        jpeg_create_compress(&cinfo);
+
+        dest.pub.init_destination = init_destination;
+        dest.pub.empty_output_buffer = empty_output_buffer;
+        dest.pub.term_destination = term_destination;
+        dest.out = &out;
+        dest.initial = std::max<size_t>((size_t)image.width * image.height / 4, 4096);
+        cinfo.dest = &dest.pub;
+
+        cinfo.image_width = image.width;
+        cinfo.image_height = image.height;
+        bool gray = image.comp < 3;
+        int input_comp = gray ? 1 : 3;
+        cinfo.in_color_space = gray ? JCS_GRAYSCALE : JCS_RGB;
+        if (image.comp == 4) {
+            input_comp = 4;
+            cinfo.in_color_space = JCS_EXT_RGBX;
+        }
+        cinfo.input_components = input_comp;
+        jpeg_set_defaults(&cinfo);
+        jpeg_set_quality(&cinfo, std::min(100, std::max(1, options.quality)), TRUE);
+        if (!gray) {
+            JpegSubsampling subsampling = options.subsampling;
+            if (subsampling == JpegSubsampling::automatic) {
+                subsampling = options.quality <= 90 ? JpegSubsampling::s420 : JpegSubsampling::s444;
+            }
+            cinfo.comp_info[0].h_samp_factor = subsampling == JpegSubsampling::s444 ? 1 : 2;
+            cinfo.comp_info[0].v_samp_factor = subsampling == JpegSubsampling::s420 ? 2 : 1;
+        }
+        cinfo.optimize_coding = options.optimize_huffman ? TRUE : FALSE;
+        if (options.progressive) {
+            jpeg_simple_progression(&cinfo);
+        }
+
+        jpeg_start_compress(&cinfo, TRUE);
+        bool repack = input_comp != image.comp;
+        if (repack) {
+            row.resize((size_t)image.width * input_comp);
+        }
+        while (cinfo.next_scanline < cinfo.image_height) {
+            const unsigned char* src = image.data + cinfo.next_scanline * image.stride;
+            if (repack) {
+                pack_row(src, image.width, image.comp, input_comp, row.data());
+                src = row.data();
+            }
+            JSAMPROW rows[1] = { (JSAMPROW)src };
+            jpeg_write_scanlines(&cinfo, rows, 1);
+        }
+        jpeg_finish_compress(&cinfo);
+        jpeg_destroy_compress(&cinfo);
+        return true;
+    }
+};
+
+#endif
+
+}
+
+bool jpeg_backend_available(JpegBackend backend) {
+#ifdef HAVE_LIBJPEG
+    (void)backend;
+    return true;
+#else
+    return backend != JpegBackend::turbo;
+#endif
+}
+
+const JpegEncoder& jpeg_encoder(JpegBackend backend) {
+    static const StbJpegEncoder stb;
+#ifdef HAVE_LIBJPEG
+    static const TurboJpegEncoder turbo;
+    if (backend != JpegBackend::stb) return turbo;
+#else
+    (void)backend;
+#endif
+    return stb;
+}
@@ -0,0 +1,130 @@
+#include "ktx2.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <algorithm>
+
+// Khronos KTX 2.0 layout: identifier, header, index, level index, data
+// format descriptor, key/value data, then the levels smallest first.
+
+static const unsigned char ktx2_identifier[12] = {
+    0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A
+};
+
+// VkFormat values
+static const uint32_t VK_FORMAT_BC1_RGB_UNORM_BLOCK = 131;
+static const uint32_t VK_FORMAT_BC1_RGB_SRGB_BLOCK = 132;
+static const uint32_t VK_FORMAT_BC1_RGBA_UNORM_BLOCK = 133;
+static const uint32_t VK_FORMAT_BC1_RGBA_SRGB_BLOCK = 134;
+
+// Khronos data format descriptor values
+static const uint32_t KHR_DF_MODEL_BC1A = 128;
+static const uint32_t KHR_DF_PRIMARIES_BT709 = 1;
+static const uint32_t KHR_DF_TRANSFER_LINEAR = 1;
+static const uint32_t KHR_DF_TRANSFER_SRGB = 2;
+static const uint32_t KHR_DF_CHANNEL_BC1A_COLOR = 0;
+static const uint32_t KHR_DF_CHANNEL_BC1A_ALPHAPRESENT = 1;
+
+static void put_u32(std::vector<unsigned char>& buf, size_t pos, uint32_t val) {
+    memcpy(buf.data() + pos, &val, 4);
+}
+
+static void put_u64(std::vector<unsigned char>& buf, size_t pos, uint64_t val) {
+    memcpy(buf.data() + pos, &val, 8);
+}
+
+size_t bc1_level_size(int width, int height) {
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * 8;
+}
+
+bool write_ktx2_bc1(std::vector<unsigned char>& out, int width, int height,
+                    const std::vector<Ktx2Level>& levels, bool alpha, bool srgb) {
+    if (levels.empty() || width <= 0 || height <= 0) {
+        return false;
+    }
+    for (size_t i = 0; i < levels.size(); i++) {
+        int w = std::max(1, width >> i);
+        int h = std::max(1, height >> i);
+        if (!levels[i].data || levels[i].size != bc1_level_size(w, h)) {
+            return false;
+        }
+    }
+
+    const size_t header_size = 12 + 9 * 4 + 4 * 4 + 2 * 8;     // 80
+    const size_t level_index_size = levels.size() * 3 * 8;
+    const size_t dfd_size = 4 + 24 + 16;                       // one sample
+    std::string writer = "osgb2tiles";
+    const size_t kv_length = 10 + writer.size() + 1;           // "KTXwriter\0" + value\0
+    const size_t kvd_size = (4 + kv_length + 3) & ~size_t(3);
+
+    size_t dfd_offset = header_size + level_index_size;
+    size_t kvd_offset = dfd_offset + dfd_size;
+    size_t data_offset = kvd_offset + kvd_size;
+    // levels align to lcm(texel block size 8, 4)
+    data_offset = (data_offset + 7) & ~size_t(7);
+
+    size_t total = data_offset;
+    for (auto& level : levels) {
+        total = ((total + 7) & ~size_t(7)) + level.size;
+    }
+
+    std::vector<unsigned char> file(total, 0);
+    memcpy(file.data(), ktx2_identifier, 12);
+    uint32_t vk_format = alpha
+        ? (srgb ? VK_FORMAT_BC1_RGBA_SRGB_BLOCK : VK_FORMAT_BC1_RGBA_UNORM_BLOCK)
+        : (srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK);
+    put_u32(file, 12, vk_format);
+    put_u32(file, 16, 1);                   // typeSize, 1 for block formats
+    put_u32(file, 20, width);
+    put_u32(file, 24, height);
+    put_u32(file, 28, 0);                   // pixelDepth
+    put_u32(file, 32, 0);                   // layerCount
+    put_u32(file, 36, 1);                   // faceCount
+    put_u32(file, 40, (uint32_t)levels.size());
+    put_u32(file, 44, 0);                   // supercompressionScheme
+    put_u32(file, 48, (uint32_t)dfd_offset);
+    put_u32(file, 52, (uint32_t)dfd_size);
+    put_u32(file, 56, (uint32_t)kvd_offset);
+    put_u32(file, 60, (uint32_t)kvd_size);
+    put_u64(file, 64, 0);                   // no supercompression global data
+    put_u64(file, 72, 0);
+
+    // level data smallest first, the index still starts at level 0
+    size_t pos = data_offset;
+    for (size_t i = levels.size(); i-- > 0;) {
+        pos = (pos + 7) & ~size_t(7);
+        memcpy(file.data() + pos, levels[i].data, levels[i].size);
+        size_t index = header_size + i * 24;
+        put_u64(file, index, pos);
+        put_u64(file, index + 8, levels[i].size);
+        put_u64(file, index + 16, levels[i].size);
+        pos += levels[i].size;
+    }
+
+    // basic data format descriptor block
+    size_t dfd = dfd_offset;
+    put_u32(file, dfd, (uint32_t)dfd_size);
+    put_u32(file, dfd + 4, 0);              // vendor Khronos, type basic
+    put_u32(file, dfd + 8, 2 | (uint32_t)(24 + 16) << 16);     // version 2, block size
+    put_u32(file, dfd + 12, KHR_DF_MODEL_BC1A
+        | KHR_DF_PRIMARIES_BT709 << 8
+        | (srgb ? KHR_DF_TRANSFER_SRGB : KHR_DF_TRANSFER_LINEAR) << 16);
+    put_u32(file, dfd + 16, 3 | 3 << 8);    // 4x4 texel blocks
+    put_u32(file, dfd + 20, 8);             // 8 bytes per block in plane 0
+    put_u32(file, dfd + 24, 0);
+    // the single sample covers the whole 64 bit block
+    uint32_t channel = alpha ? KHR_DF_CHANNEL_BC1A_ALPHAPRESENT : KHR_DF_CHANNEL_BC1A_COLOR;
+    put_u32(file, dfd + 28, 0 | 63u << 16 | channel << 24);
+    put_u32(file, dfd + 32, 0);             // sample position
+    put_u32(file, dfd + 36, 0);             // lower
+    put_u32(file, dfd + 40, 0xFFFFFFFFu);   // upper
+
+    size_t kvd = kvd_offset;
+    put_u32(file, kvd, (uint32_t)kv_length);
+    memcpy(file.data() + kvd + 4, "KTXwriter", 10);
+    memcpy(file.data() + kvd + 14, writer.c_str(), writer.size() + 1);
+
+    out.insert(out.end(), file.begin(), file.end());
+    return true;
+}
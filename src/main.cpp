@@ -2,10 +2,14 @@
 #include <cxxopts.hpp>
 #include <fstream>
 #include <tinyxml2.h>
+#include <map>
 #include <string>
 #include <vector>
+#include <sstream>
 #include "osgb.h"
 #include "tileset.h"
+#include "meshopt_encoder.h"
+#include "draco_encoder.h"
 
 #include <unistd.h>
 #include <limits.h>
@@ -190,6 +194,22 @@ bool transform(double source_x, double source_y, double& target_x, double& targe
     return true;
 }
 
+// "15:512,21:2048" -> {15: 512, 21: 2048}
+bool parse_lod_values(const std::string& spec, std::map<int, int>& values) {
+    std::stringstream ss(spec);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        int lvl, value;
+        char sep;
+        std::stringstream is(item);
+        if (!(is >> lvl >> sep >> value) || sep != ':' || value <= 0) {
+            return false;
+        }
+        values[lvl] = value;
+    }
+    return true;
+}
+
 int main(int argc, char* argv[])
 {
     cxxopts::Options options("osgb2tiles", "A simple program which can convert osgb files to 3dtiles.");
@@ -197,6 +217,40 @@ int main(int argc, char* argv[])
         ("i,input", "Input directory", cxxopts::value<std::string>())
         ("o,output", "Output directory", cxxopts::value<std::string>())
         ("q,quality", "Quality", cxxopts::value<float>()->default_value("1.0"))
+        ("j,jobs", "Number of worker threads (0 = all cores)", cxxopts::value<unsigned>()->default_value("0"))
+        ("read-threads", "Pipeline threads reading osgb files (0 = from jobs)", cxxopts::value<unsigned>()->default_value("0"))
+        ("build-threads", "Pipeline threads building geometry (0 = from jobs)", cxxopts::value<unsigned>()->default_value("0"))
+        ("encode-threads", "Pipeline threads encoding textures (0 = from jobs)", cxxopts::value<unsigned>()->default_value("0"))
+        ("write-threads", "Threads writing b3dm files without io_uring (0 = from jobs)", cxxopts::value<unsigned>()->default_value("0"))
+        ("io-depth", "b3dm files in flight in the output writer (0 = 64)", cxxopts::value<unsigned>()->default_value("0"))
+        ("queue-depth", "Tiles buffered between pipeline stages (0 = from jobs)", cxxopts::value<size_t>()->default_value("0"))
+        ("memory-budget", "MiB of tiles in flight, estimated per tile (0 = unlimited)", cxxopts::value<unsigned>()->default_value("0"))
+        ("texture-format", "Texture output: jpeg, ktx2 to copy DXT1 textures as BC1, basisu or webp", cxxopts::value<std::string>()->default_value("jpeg"))
+        ("texture-fallback", "With ktx2, basisu or webp also embed a jpeg of each texture")
+        ("basis-mode", "Basis Universal codec: etc1s or uastc", cxxopts::value<std::string>()->default_value("etc1s"))
+        ("basis-quality", "Basis ETC1S quality, 1..255", cxxopts::value<int>()->default_value("128"))
+        ("jpeg-encoder", "Jpeg encoder: auto, stb or turbo (libjpeg-turbo)", cxxopts::value<std::string>()->default_value("auto"))
+        ("jpeg-subsampling", "Jpeg chroma subsampling: auto, 444, 422 or 420", cxxopts::value<std::string>()->default_value("auto"))
+        ("jpeg-progressive", "Write progressive jpeg textures")
+        ("jpeg-optimize", "Optimize the jpeg huffman tables of each texture")
+        ("shared-textures", "Write each unique texture once under Data/textures, tiles reference the file")
+        ("texture-cache", "MiB of encoded textures kept for reuse by later tiles (0 = no reuse)", cxxopts::value<unsigned>()->default_value("256"))
+        ("max-texture-size", "Textures are halved until both sides fit", cxxopts::value<int>()->default_value("2048"))
+        ("lod-texture-size", "Max texture size per _L level, e.g. 15:512,21:2048", cxxopts::value<std::string>())
+        ("merge-primitives", "Merge the primitives of a tile that share a material into one draw")
+        ("optimize-mesh", "Reorder triangles for the vertex cache and vertices for fetch locality")
+        ("optimize-overdraw", "Like --optimize-mesh, then order triangle clusters to reduce overdraw")
+        ("geometry-codec", "Geometry compression: none, meshopt (EXT_meshopt_compression) or draco (KHR_draco_mesh_compression)", cxxopts::value<std::string>()->default_value("none"))
+        ("geometry-fallback", "With a geometry codec also keep the uncompressed geometry in each tile")
+        ("draco-position-bits", "Draco position quantization bits (0 = lossless)", cxxopts::value<int>()->default_value("14"))
+        ("draco-normal-bits", "Draco normal quantization bits (0 = lossless)", cxxopts::value<int>()->default_value("10"))
+        ("draco-texcoord-bits", "Draco texcoord quantization bits (0 = lossless)", cxxopts::value<int>()->default_value("12"))
+        ("quantize", "Store positions, normals and texcoords as integers (KHR_mesh_quantization)")
+        ("position-bits", "Quantized position precision in bits, 2..16", cxxopts::value<int>()->default_value("16"))
+        ("lod-position-bits", "Quantized position bits per _L level, e.g. 15:12,21:16", cxxopts::value<std::string>())
+        ("texture-crop", "Crop each texture to the part of it the tile's texcoords use")
+        ("texture-atlas", "Pack the textures of each tile into at most two atlases and merge their primitives")
+        ("dry-run", "Only scan the LOD trees and print their sizes")
         //("f,format", "Output format (e.g., 3dtiles)", cxxopts::value<std::string>())
         ("h,help", "Print usage");
     auto result = options.parse(argc, argv);
@@ -206,6 +260,11 @@ int main(int argc, char* argv[])
         return 0;
     }
 
+    if (result.count("dry-run") && result.count("input")) {
+        osgb_batch_scan(result["input"].as<std::string>(), result["jobs"].as<unsigned>());
+        return 0;
+    }
+
     if (!result.count("input") || !result.count("output")) {
             std::cerr << "Error: Input and Output are required.\n";
             std::cerr << options.help() << std::endl;
@@ -215,8 +274,131 @@ int main(int argc, char* argv[])
     fs::path input = result["input"].as<std::string>();
     fs::path output = result["output"].as<std::string>();
 
-    float quality = result["quality"].as<float>();
-    quality = std::clamp(quality, 0.f, 1.f);
+    ConversionOptions conv_options;
+    conv_options.quality = std::clamp(result["quality"].as<float>(), 0.f, 1.f);
+    std::string texture_format = result["texture-format"].as<std::string>();
+    if (texture_format == "ktx2") {
+        conv_options.texture_format = TextureFormat::ktx2;
+    }
+    else if (texture_format == "basisu") {
+        if (!basis_available()) {
+            std::cerr << "Error: built without the basisu encoder\n";
+            return 1;
+        }
+        conv_options.texture_format = TextureFormat::basisu;
+    }
+    else if (texture_format == "webp") {
+        if (!webp_available()) {
+            std::cerr << "Error: built without libwebp\n";
+            return 1;
+        }
+        conv_options.texture_format = TextureFormat::webp;
+    }
+    else if (texture_format != "jpeg") {
+        std::cerr << "Error: unknown texture format " << texture_format << "\n";
+        return 1;
+    }
+    conv_options.texture_fallback = result.count("texture-fallback") > 0;
+    std::string basis_mode = result["basis-mode"].as<std::string>();
+    if (basis_mode == "uastc") {
+        conv_options.basis_mode = BasisMode::uastc;
+    }
+    else if (basis_mode != "etc1s") {
+        std::cerr << "Error: unknown basis mode " << basis_mode << "\n";
+        return 1;
+    }
+    conv_options.basis_quality = std::clamp(result["basis-quality"].as<int>(), 1, 255);
+    std::string jpeg_encoder_name = result["jpeg-encoder"].as<std::string>();
+    if (jpeg_encoder_name == "stb") {
+        conv_options.jpeg_backend = JpegBackend::stb;
+    }
+    else if (jpeg_encoder_name == "turbo") {
+        conv_options.jpeg_backend = JpegBackend::turbo;
+    }
+    else if (jpeg_encoder_name != "auto") {
+        std::cerr << "Error: unknown jpeg encoder " << jpeg_encoder_name << "\n";
+        return 1;
+    }
+    if (!jpeg_backend_available(conv_options.jpeg_backend)) {
+        std::cerr << "Error: built without libjpeg-turbo\n";
+        return 1;
+    }
+    std::string subsampling = result["jpeg-subsampling"].as<std::string>();
+    if (subsampling == "444") {
+        conv_options.jpeg_subsampling = JpegSubsampling::s444;
+    }
+    else if (subsampling == "422") {
+        conv_options.jpeg_subsampling = JpegSubsampling::s422;
+    }
+    else if (subsampling == "420") {
+        conv_options.jpeg_subsampling = JpegSubsampling::s420;
+    }
+    else if (subsampling != "auto") {
+        std::cerr << "Error: unknown jpeg subsampling " << subsampling << "\n";
+        return 1;
+    }
+    conv_options.jpeg_progressive = result.count("jpeg-progressive") > 0;
+    conv_options.jpeg_optimize = result.count("jpeg-optimize") > 0;
+    conv_options.shared_textures = result.count("shared-textures") > 0;
+    conv_options.texture_cache_bytes = (uint64_t)result["texture-cache"].as<unsigned>() << 20;
+    conv_options.max_texture_size = std::max(1, result["max-texture-size"].as<int>());
+    conv_options.texture_crop = result.count("texture-crop") > 0;
+    conv_options.texture_atlas = result.count("texture-atlas") > 0;
+    if (result.count("lod-texture-size")
+        && !parse_lod_values(result["lod-texture-size"].as<std::string>(), conv_options.lod_texture_size)) {
+        std::cerr << "Error: bad lod texture size " << result["lod-texture-size"].as<std::string>() << "\n";
+        return 1;
+    }
+    conv_options.merge_primitives = result.count("merge-primitives") > 0;
+    conv_options.optimize_overdraw = result.count("optimize-overdraw") > 0;
+    conv_options.optimize_mesh = result.count("optimize-mesh") > 0 || conv_options.optimize_overdraw;
+    std::string geometry_codec = result["geometry-codec"].as<std::string>();
+    if (geometry_codec == "meshopt") {
+        if (!meshopt_available()) {
+            std::cerr << "Error: built without meshoptimizer\n";
+            return 1;
+        }
+        conv_options.geometry_codec = GeometryCodec::meshopt;
+    }
+    else if (geometry_codec == "draco") {
+        if (!draco_available()) {
+            std::cerr << "Error: built without draco\n";
+            return 1;
+        }
+        conv_options.geometry_codec = GeometryCodec::draco;
+    }
+    else if (geometry_codec != "none") {
+        std::cerr << "Error: unknown geometry codec " << geometry_codec << "\n";
+        return 1;
+    }
+    conv_options.geometry_fallback = result.count("geometry-fallback") > 0;
+    conv_options.draco_position_bits = std::clamp(result["draco-position-bits"].as<int>(), 0, 30);
+    conv_options.draco_normal_bits = std::clamp(result["draco-normal-bits"].as<int>(), 0, 30);
+    conv_options.draco_texcoord_bits = std::clamp(result["draco-texcoord-bits"].as<int>(), 0, 30);
+    conv_options.quantize = result.count("quantize") > 0;
+    conv_options.position_bits = result["position-bits"].as<int>();
+    if (result.count("lod-position-bits")
+        && !parse_lod_values(result["lod-position-bits"].as<std::string>(), conv_options.lod_position_bits)) {
+        std::cerr << "Error: bad lod position bits " << result["lod-position-bits"].as<std::string>() << "\n";
+        return 1;
+    }
+    bool bits_ok = conv_options.position_bits >= 2 && conv_options.position_bits <= 16;
+    for (auto& entry : conv_options.lod_position_bits) {
+        bits_ok = bits_ok && entry.second >= 2 && entry.second <= 16;
+    }
+    if (!bits_ok) {
+        std::cerr << "Error: position bits must be 2..16\n";
+        return 1;
+    }
+    unsigned jobs = result["jobs"].as<unsigned>();
+    PipelineOptions pipeline_options;
+    pipeline_options.read_threads = result["read-threads"].as<unsigned>();
+    pipeline_options.build_threads = result["build-threads"].as<unsigned>();
+    pipeline_options.encode_threads = result["encode-threads"].as<unsigned>();
+    pipeline_options.write_threads = result["write-threads"].as<unsigned>();
+    pipeline_options.io_depth = result["io-depth"].as<unsigned>();
+    pipeline_options.queue_depth = result["queue-depth"].as<size_t>();
+    pipeline_options.memory_budget = (uint64_t)result["memory-budget"].as<unsigned>() << 20;
 
     // 836974.635391304,815456.572217391
     // 114.18373090671055,22.277972645442148
@@ -236,7 +418,7 @@ int main(int argc, char* argv[])
     auto metadata = model_metadata::from_xml(root);
     if (metadata.srs_.authority == "EPSG"){
         transform(metadata.srs_origin_.x, metadata.srs_origin_.y, metadata.srs_origin_.x, metadata.srs_origin_.y, metadata.srs_.code);
-        osgb_batch_convert(input, output, metadata.srs_origin_.x, metadata.srs_origin_.y, quality);
+        osgb_batch_convert(input, output, metadata.srs_origin_.x, metadata.srs_origin_.y, conv_options, jobs, pipeline_options);
     }
     else if (metadata.srs_.authority == "ENU"){
         // TODO: to be implemented
@@ -0,0 +1,32 @@
+#include "memory_budget.h"
+
+#include <algorithm>
+
+void MemoryBudget::acquire(uint64_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this, bytes]() {
+        return limit_ == 0 || used_ == 0 || used_ + bytes <= limit_;
+    });
+    used_ += bytes;
+    peak_ = std::max(peak_, used_);
+}
+
+void MemoryBudget::resize(uint64_t from, uint64_t to) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    used_ = used_ - from + to;
+    peak_ = std::max(peak_, used_);
+    if (to < from) {
+        cv_.notify_all();
+    }
+}
+
+void MemoryBudget::release(uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    used_ -= bytes;
+    cv_.notify_all();
+}
+
+uint64_t MemoryBudget::peak() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return peak_;
+}
@@ -0,0 +1,236 @@
+#include "mesh_optimize.h"
+
+#include <cmath>
+#include <numeric>
+#include <algorithm>
+
+// triangles of every vertex as one flat list (offsets, then triangles)
+struct VertexTriangles {
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> triangles;
+
+    VertexTriangles(const std::vector<uint32_t>& indices, size_t vertex_count)
+        : offsets(vertex_count + 1, 0), triangles(indices.size()) {
+        for (uint32_t v : indices) offsets[v + 1]++;
+        for (size_t v = 0; v < vertex_count; v++) offsets[v + 1] += offsets[v];
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++) triangles[fill[indices[i]]++] = (uint32_t)(i / 3);
+    }
+};
+
+// FIFO cache simulation, returns the misses of one triangle
+struct FifoCache {
+    std::vector<uint32_t> stamps;   // time each vertex entered the cache, 0 = never
+    uint32_t time;
+    int size;
+
+    FifoCache(size_t vertex_count, int cache_size) : stamps(vertex_count, 0), time(cache_size + 1), size(cache_size) {}
+
+    void reset() { time += size + 1; }
+
+    unsigned add(const uint32_t* triangle) {
+        unsigned misses = 0;
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = triangle[k];
+            if (time - stamps[v] > (uint32_t)size) {
+                stamps[v] = time++;
+                misses++;
+            }
+        }
+        return misses;
+    }
+};
+
+float average_cache_miss_ratio(const std::vector<uint32_t>& indices, size_t vertex_count, int cache_size) {
+    if (indices.size() < 3) return 0.0f;
+    FifoCache cache(vertex_count, cache_size);
+    unsigned misses = 0;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) misses += cache.add(&indices[i]);
+    return (float)misses / (indices.size() / 3);
+}
+
+// Tipsify: fan around a vertex still in the cache, emitting every live
+// triangle of it. `order` gets the triangles, `clusters` the position in
+// order of every restart where no cached vertex was left.
+static void tipsify(const std::vector<uint32_t>& indices, size_t vertex_count, int cache_size,
+                    std::vector<uint32_t>& order, std::vector<uint32_t>& clusters) {
+    size_t triangle_count = indices.size() / 3;
+    VertexTriangles adjacency(indices, vertex_count);
+    std::vector<uint32_t> live(vertex_count);
+    for (size_t v = 0; v < vertex_count; v++) live[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+    std::vector<uint32_t> cache_time(vertex_count, 0);
+    std::vector<char> emitted(triangle_count, 0);
+    std::vector<uint32_t> dead_end;
+    std::vector<uint32_t> candidates;
+    uint32_t time = cache_size + 1;
+    size_t cursor = 0;
+    order.clear();
+    clusters.clear();
+
+    long fan = -1;
+    while (true) {
+        if (fan < 0) {
+            // dead end: the most recent vertex with work left, else the next one in order
+            while (!dead_end.empty() && fan < 0) {
+                uint32_t v = dead_end.back();
+                dead_end.pop_back();
+                if (live[v] > 0) fan = v;
+            }
+            while (fan < 0 && cursor < vertex_count) {
+                if (live[cursor] > 0) fan = (long)cursor;
+                cursor++;
+            }
+            if (fan < 0) break;
+            clusters.push_back((uint32_t)order.size());
+        }
+        candidates.clear();
+        for (uint32_t a = adjacency.offsets[fan]; a < adjacency.offsets[fan + 1]; a++) {
+            uint32_t t = adjacency.triangles[a];
+            if (emitted[t]) continue;
+            emitted[t] = 1;
+            order.push_back(t);
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = indices[t * 3 + k];
+                dead_end.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - cache_time[v] > (uint32_t)cache_size) {
+                    cache_time[v] = time++;
+                }
+            }
+        }
+        // the candidate that stays in the cache the longest while its fan is emitted
+        long best = -1;
+        long best_priority = -1;
+        for (uint32_t v : candidates) {
+            if (live[v] == 0) continue;
+            long priority = 0;
+            if (time - cache_time[v] + 2 * live[v] <= (uint32_t)cache_size) {
+                priority = time - cache_time[v];
+            }
+            if (priority > best_priority) {
+                best_priority = priority;
+                best = v;
+            }
+        }
+        fan = best;
+    }
+}
+
+// Split the hard clusters where the cache misses so far stay within
+// threshold times the cluster's own, then sort every cluster by how far
+// its centroid lies out along its normal.
+static void sort_clusters(const MeshPrimitive& primitive, std::vector<uint32_t>& order,
+                          const std::vector<uint32_t>& hard, int cache_size, float threshold) {
+    const std::vector<uint32_t>& indices = primitive.indices;
+    std::vector<uint32_t> bounds;
+    FifoCache cache(primitive.vertex_count(), cache_size);
+    for (size_t c = 0; c < hard.size(); c++) {
+        size_t start = hard[c];
+        size_t end = (c + 1 < hard.size()) ? hard[c + 1] : order.size();
+        unsigned cluster_misses = 0;
+        cache.reset();
+        for (size_t i = start; i < end; i++) cluster_misses += cache.add(&indices[order[i] * 3]);
+        float limit = threshold * cluster_misses / (end - start);
+        cache.reset();
+        bounds.push_back(start);
+        size_t soft_start = start;
+        unsigned misses = 0;
+        for (size_t i = start; i + 1 < end; i++) {
+            misses += cache.add(&indices[order[i] * 3]);
+            if ((float)misses / (i + 1 - soft_start) <= limit) {
+                bounds.push_back(i + 1);
+                soft_start = i + 1;
+                misses = 0;
+                cache.reset();
+            }
+        }
+    }
+
+    const std::vector<float>& p = primitive.positions;
+    double mesh_centroid[3] = { 0, 0, 0 };
+    for (size_t v = 0; v < primitive.vertex_count(); v++) {
+        for (int k = 0; k < 3; k++) mesh_centroid[k] += p[v * 3 + k];
+    }
+    for (int k = 0; k < 3; k++) mesh_centroid[k] /= std::max<size_t>(1, primitive.vertex_count());
+
+    std::vector<double> keys(bounds.size());
+    for (size_t c = 0; c < bounds.size(); c++) {
+        size_t end = (c + 1 < bounds.size()) ? bounds[c + 1] : order.size();
+        double normal[3] = { 0, 0, 0 };
+        double centroid[3] = { 0, 0, 0 };
+        double area = 0;
+        for (size_t i = bounds[c]; i < end; i++) {
+            const float* a = &p[indices[order[i] * 3] * 3];
+            const float* b = &p[indices[order[i] * 3 + 1] * 3];
+            const float* d = &p[indices[order[i] * 3 + 2] * 3];
+            double e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+            double e2[3] = { d[0] - a[0], d[1] - a[1], d[2] - a[2] };
+            double n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+            double w = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (int k = 0; k < 3; k++) {
+                normal[k] += n[k];
+                centroid[k] += (a[k] + b[k] + d[k]) / 3.0 * w;
+            }
+            area += w;
+        }
+        double length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (area <= 0 || length <= 0) continue;
+        for (int k = 0; k < 3; k++) keys[c] += (centroid[k] / area - mesh_centroid[k]) * normal[k] / length;
+    }
+
+    std::vector<uint32_t> sorted(bounds.size());
+    std::iota(sorted.begin(), sorted.end(), 0);
+    std::stable_sort(sorted.begin(), sorted.end(), [&keys](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+    std::vector<uint32_t> reordered;
+    reordered.reserve(order.size());
+    for (uint32_t c : sorted) {
+        size_t end = (c + 1 < bounds.size()) ? bounds[c + 1] : order.size();
+        reordered.insert(reordered.end(), order.begin() + bounds[c], order.begin() + end);
+    }
+    order.swap(reordered);
+}
+
+void optimize_vertex_cache(MeshPrimitive& primitive, bool overdraw, float overdraw_threshold) {
+    if (primitive.indices.size() < 6 || primitive.indices.size() % 3 != 0) {
+        return;
+    }
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> clusters;
+    tipsify(primitive.indices, primitive.vertex_count(), vertex_cache_size, order, clusters);
+    if (overdraw) {
+        sort_clusters(primitive, order, clusters, vertex_cache_size, overdraw_threshold);
+    }
+    std::vector<uint32_t> indices;
+    indices.reserve(primitive.indices.size());
+    for (uint32_t t : order) {
+        indices.insert(indices.end(), &primitive.indices[t * 3], &primitive.indices[t * 3] + 3);
+    }
+    primitive.indices.swap(indices);
+    // triangles of different draws are interleaved now
+    primitive.draw_ends.clear();
+}
+
+template<int N>
+static void remap_attribute(std::vector<float>& values, const std::vector<uint32_t>& remap, size_t count) {
+    if (values.empty()) return;
+    std::vector<float> out(count * N);
+    for (size_t v = 0; v < remap.size(); v++) {
+        if (remap[v] == UINT32_MAX) continue;
+        std::copy(&values[v * N], &values[v * N] + N, &out[remap[v] * N]);
+    }
+    values.swap(out);
+}
+
+void optimize_vertex_fetch(MeshPrimitive& primitive) {
+    std::vector<uint32_t> remap(primitive.vertex_count(), UINT32_MAX);
+    uint32_t next = 0;
+    for (uint32_t& v : primitive.indices) {
+        if (remap[v] == UINT32_MAX) remap[v] = next++;
+        v = remap[v];
+    }
+    // vertices no triangle uses are dropped
+    remap_attribute<3>(primitive.positions, remap, next);
+    remap_attribute<3>(primitive.normals, remap, next);
+    remap_attribute<2>(primitive.texcoords, remap, next);
+}
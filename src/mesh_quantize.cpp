@@ -0,0 +1,60 @@
+#include "mesh_quantize.h"
+
+#include <cmath>
+#include <algorithm>
+
+PositionQuantization position_quantization(const double* min, const double* max, int bits) {
+    PositionQuantization q;
+    q.bits = std::min(16, std::max(2, bits));
+    double extent = 0.0;
+    for (int i = 0; i < 3; i++) {
+        q.offset[i] = (min[i] + max[i]) * 0.5;
+        extent = std::max(extent, max[i] - min[i]);
+    }
+    q.half_extent = extent > 0.0 ? extent * 0.5 : 1.0;
+    int steps = (1 << (q.bits - 1)) - 1;
+    q.scale = q.half_extent * 32767.0 / steps;
+    return q;
+}
+
+void quantize_positions(const std::vector<float>& positions, const PositionQuantization& q,
+                        std::vector<int16_t>& out) {
+    int steps = (1 << (q.bits - 1)) - 1;
+    double factor = steps / q.half_extent;
+    size_t count = positions.size() / 3;
+    out.resize(count * 4);
+    for (size_t v = 0; v < count; v++) {
+        for (int i = 0; i < 3; i++) {
+            double value = std::round((positions[v * 3 + i] - q.offset[i]) * factor);
+            out[v * 4 + i] = (int16_t)std::min<double>(steps, std::max<double>(-steps, value));
+        }
+        out[v * 4 + 3] = 0;
+    }
+}
+
+void quantize_normals(const std::vector<float>& normals, std::vector<int8_t>& out) {
+    size_t count = normals.size() / 3;
+    out.resize(count * 4);
+    for (size_t v = 0; v < count; v++) {
+        const float* n = &normals[v * 3];
+        float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        float inv = length > 0.0f ? 127.0f / length : 0.0f;
+        for (int i = 0; i < 3; i++) {
+            out[v * 4 + i] = (int8_t)std::lround(n[i] * inv);
+        }
+        out[v * 4 + 3] = 0;
+    }
+}
+
+bool quantize_texcoords(const std::vector<float>& texcoords, std::vector<uint16_t>& out) {
+    out.resize(texcoords.size());
+    for (size_t i = 0; i < texcoords.size(); i++) {
+        float t = texcoords[i];
+        // float error past the texture edge is clamped
+        if (!(t >= -1e-4f && t <= 1.0f + 1e-4f)) {
+            return false;
+        }
+        out[i] = (uint16_t)std::lround(std::min(1.0f, std::max(0.0f, t)) * 65535.0f);
+    }
+    return true;
+}
@@ -0,0 +1,77 @@
+#include "meshopt_encoder.h"
+
+#ifdef HAVE_MESHOPTIMIZER
+#include <mutex>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <meshoptimizer.h>
+
+// EXT_meshopt_compression decoders read vertex codec 0 and index codec 1,
+// the library may default to newer ones
+static void init_meshopt() {
+    static std::once_flag once;
+    std::call_once(once, []() {
+        meshopt_encodeVertexVersion(0);
+        meshopt_encodeIndexVersion(1);
+    });
+}
+
+bool meshopt_available() {
+    return true;
+}
+
+bool meshopt_encode_attributes(const unsigned char* data, size_t count, size_t byte_stride,
+                               std::vector<unsigned char>& out) {
+    if (byte_stride == 0 || byte_stride % 4 != 0 || byte_stride > 256) {
+        return false;
+    }
+    init_meshopt();
+    size_t start = out.size();
+    out.resize(start + meshopt_encodeVertexBufferBound(count, byte_stride));
+    size_t size = meshopt_encodeVertexBuffer(&out[start], out.size() - start, data, count, byte_stride);
+    out.resize(start + size);
+    return size > 0;
+}
+
+bool meshopt_encode_triangles(const unsigned char* data, size_t count, size_t index_size,
+                              std::vector<unsigned char>& out) {
+    if (count % 3 != 0 || (index_size != 2 && index_size != 4)) {
+        return false;
+    }
+    init_meshopt();
+    std::vector<unsigned int> indices(count);
+    unsigned int vertex_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (index_size == 2) {
+            uint16_t index;
+            memcpy(&index, data + i * 2, 2);
+            indices[i] = index;
+        }
+        else {
+            memcpy(&indices[i], data + i * 4, 4);
+        }
+        vertex_count = std::max(vertex_count, indices[i] + 1);
+    }
+    size_t start = out.size();
+    out.resize(start + meshopt_encodeIndexBufferBound(count, vertex_count));
+    size_t size = meshopt_encodeIndexBuffer(&out[start], out.size() - start, indices.data(), count);
+    out.resize(start + size);
+    return size > 0;
+}
+
+#else
+
+bool meshopt_available() {
+    return false;
+}
+
+bool meshopt_encode_attributes(const unsigned char*, size_t, size_t, std::vector<unsigned char>&) {
+    return false;
+}
+
+bool meshopt_encode_triangles(const unsigned char*, size_t, size_t, std::vector<unsigned char>&) {
+    return false;
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include "osgb.h"
 #include <iostream>
+#include <iomanip>
 #include <cmath>
 #include <filesystem>
 
@@ -8,9 +9,17 @@
 #include <cstring>
 #include <nlohmann/json.hpp>
 #include <algorithm>
+#include <thread>
+#include <climits>
 
 #include "tileset.h"
 #include "osgb23dtiles.h"
+#include "thread_pool.h"
+#include "tile_pipeline.h"
+#include "osgb_index.h"
+#include "conversion_profile.h"
+#include "texture_store.h"
+#include "tile_stages.h"
 
 namespace fs = std::filesystem;
 
@@ -43,19 +52,19 @@ std::vector<double> box_to_tileset_box(const std::vector<double>& box_v) {
     return box_new;
 }
 
-void osgb_batch_convert(const fs::path& input, const fs::path& output, double center_x, double center_y, float quality){
+struct TileBlock {
+    std::string stem;
+    fs::path osgb;
+    double cost = 0.0;
+};
+
+// Data/Tile_*/Tile_*.osgb root files, in directory order
+static std::vector<TileBlock> list_tile_blocks(const fs::path& input) {
     fs::path path = input / "Data";
     if (!fs::exists(path) || !fs::is_directory(path)) {
         throw std::runtime_error("Directory " + path.string() + " does not exist");
     }
-
-    mkdirs(output.c_str());
-    std::vector<OsgbInfo> osgb_dir_pair;
-    std::vector<TileResult> tiles;
-    
-    double rad_x = degree2rad(center_x);
-    double rad_y = degree2rad(center_y);
-    // TODO: asio
+    std::vector<TileBlock> blocks;
     for (const auto& entry : fs::directory_iterator(path)) {
         if (fs::is_directory(entry)) {
             fs::path path_tile = entry.path();
@@ -63,31 +72,117 @@ void osgb_batch_convert(const fs::path& input, const fs::path& output, double ce
             fs::path osgb = path_tile / (stem + ".osgb");
 
             if (fs::exists(osgb) && !fs::is_directory(osgb)) {
-                fs::path out_dir = output / "Data" / stem;
-                fs::create_directories(out_dir);
-                std::vector<double> box(6, 0.0);
-                int len = 0;
-                auto out_ptr = osgb23dtile_path(osgb.string().c_str(), out_dir.string().c_str(), box.data(), &len, rad_x, rad_y, 100, true, quality);
-                std::vector<char> json_buf;
-                if (!out_ptr)
-                {
-                    std::cout << "failed: " << osgb << "\n";
-                }
-                else
-                {
-                    json_buf.resize(len);
-                    std::memcpy(json_buf.data(), out_ptr, len);
-                    std::free(out_ptr);
-                }
-                auto json = std::string(json_buf.begin(), json_buf.end());
-                auto t = TileResult{json, out_dir, box};
-                tiles.push_back(t);
+                blocks.push_back(TileBlock{stem, osgb, 0.0});
             } else {
                 std::cerr << "Directory error: " << osgb << std::endl;
             }
         }
     }
+    return blocks;
+}
+
+// total size of the osgb files of a block
+static uintmax_t block_osgb_bytes(const fs::path& dir) {
+    uintmax_t bytes = 0;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->is_regular_file(ec) && it->path().extension() == ".osgb") {
+            bytes += it->file_size(ec);
+        }
+    }
+    return bytes;
+}
+
+// Longest processing time first: a huge block that starts last sets the
+// finish time of the whole run. The cost is the stage time a previous run
+// measured where the profile has it, otherwise the block's osgb bytes scaled
+// to seconds by the blocks the profile does know.
+static void sort_blocks_by_cost(std::vector<TileBlock>& blocks, const ConversionProfile& profile) {
+    std::vector<uintmax_t> bytes(blocks.size());
+    double known_bytes = 0.0, known_seconds = 0.0;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        bytes[i] = block_osgb_bytes(blocks[i].osgb.parent_path());
+        auto it = profile.block_seconds.find(blocks[i].stem);
+        if (it != profile.block_seconds.end() && it->second > 0) {
+            known_bytes += bytes[i];
+            known_seconds += it->second;
+        }
+    }
+    double seconds_per_byte = (known_bytes > 0) ? known_seconds / known_bytes : 0.0;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        auto it = profile.block_seconds.find(blocks[i].stem);
+        if (it != profile.block_seconds.end() && it->second > 0)
+            blocks[i].cost = it->second;
+        else if (seconds_per_byte > 0)
+            blocks[i].cost = bytes[i] * seconds_per_byte;
+        else
+            blocks[i].cost = (double)bytes[i];
+    }
+    std::stable_sort(blocks.begin(), blocks.end(), [](const TileBlock& a, const TileBlock& b) {
+        return a.cost > b.cost;
+    });
+}
+
+void osgb_batch_scan(const fs::path& input, unsigned jobs) {
+    std::vector<TileBlock> blocks = list_tile_blocks(input);
+    std::vector<LodStats> stats(blocks.size());
+    {
+        ThreadPool pool(jobs);
+        TaskGroup group(&pool);
+        for (size_t i = 0; i < blocks.size(); i++) {
+            group.run([&blocks, &stats, &pool, i]() {
+                LodNode tree = scan_lod_tree(blocks[i].osgb.string(), &pool);
+                accumulate_lod_stats(tree, stats[i]);
+            });
+        }
+        group.wait();
+    }
 
+    LodStats total;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        std::cout << blocks[i].stem << ": " << stats[i].files << " files, "
+                  << stats[i].bytes << " bytes, max level " << stats[i].max_lvl << "\n";
+        total.files += stats[i].files;
+        total.bytes += stats[i].bytes;
+        total.texture_pixels += stats[i].texture_pixels;
+        total.max_lvl = std::max(total.max_lvl, stats[i].max_lvl);
+    }
+    std::cout << blocks.size() << " blocks, " << total.files << " files, "
+              << total.bytes << " bytes, " << total.texture_pixels << " texels" << std::endl;
+}
+
+// replace path in one step, a viewer reading it never sees a partial file
+static bool write_file_atomic(const fs::path& path, const std::string& buf) {
+    fs::path tmp = path;
+    tmp += ".tmp";
+    if (!write_file(tmp.string().c_str(), buf.data(), buf.size())) {
+        return false;
+    }
+    std::error_code ec;
+    fs::rename(tmp, path, ec);
+    return !ec;
+}
+
+// tileset json of every block from its nodes at level <= lvl; the deeper
+// nodes may still be under conversion and are not read
+static std::vector<TileResult> collect_block_tilesets(const std::vector<osg_tree>& roots, const std::vector<fs::path>& out_dirs, int lvl, double rad_x, double rad_y, bool report) {
+    std::vector<TileResult> tiles;
+    for (size_t i = 0; i < roots.size(); i++) {
+        osg_tree tree;
+        std::vector<double> box(6, 0.0);
+        std::string json;
+        if (copy_tree_upto(roots[i], lvl, tree) && tile_tree_json(tree, rad_x, rad_y, json, box.data())) {
+            tiles.push_back(TileResult{json, out_dirs[i].string(), box});
+        }
+        else if (report) {
+            std::cout << "failed: " << roots[i].file_name << "\n";
+        }
+    }
+    return tiles;
+}
+
+// block tileset.json files plus the root tileset.json over them
+static void write_tilesets(const fs::path& output, const std::vector<TileResult>& tiles, double center_x, double center_y) {
     std::vector<double> root_box = {
         std::numeric_limits<double>::min(),  std::numeric_limits<double>::min(), std::numeric_limits<double>::min(),
         std::numeric_limits<double>::max(),  std::numeric_limits<double>::max(), std::numeric_limits<double>::max()
@@ -162,8 +257,101 @@ void osgb_batch_convert(const fs::path& input, const fs::path& output, double ce
             {"root", json_val}
         };
 
-        write_file(std::string(fs::path(path) / "tileset.json").c_str(), sub_tile.dump().c_str(), sub_tile.dump().size());
+        write_file_atomic(fs::path(path) / "tileset.json", sub_tile.dump());
     }
-    
-    write_file(std::string(output / "tileset.json").c_str(), root_json.dump().c_str(), root_json.dump().size());
+
+    write_file_atomic(output / "tileset.json", root_json.dump());
+}
+
+void osgb_batch_convert(const fs::path& input, const fs::path& output, double center_x, double center_y, const ConversionOptions& options, unsigned jobs, const PipelineOptions& pipeline_options){
+    std::vector<TileBlock> blocks = list_tile_blocks(input);
+
+    mkdirs(output.c_str());
+    fs::create_directories(output / "Data");
+
+    // a previous run into the same directory knows the real tile footprints
+    ConversionProfile profile;
+    std::string profile_file = profile_path(output.string());
+    PipelineOptions run_options = pipeline_options;
+    if (load_profile(profile_file, profile) && run_options.memory_ratio <= 0) {
+        run_options.memory_ratio = profile.memory_ratio;
+    }
+    sort_blocks_by_cost(blocks, profile);
+
+    double rad_x = degree2rad(center_x);
+    double rad_y = degree2rad(center_y);
+    std::vector<osg_tree> roots(blocks.size());
+    std::vector<fs::path> out_dirs;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        roots[i].file_name = blocks[i].osgb.string();
+        out_dirs.push_back(output / "Data" / blocks[i].stem);
+        fs::create_directories(out_dirs.back());
+    }
+    {
+        unsigned threads = jobs ? jobs : std::max(1u, std::thread::hardware_concurrency());
+        ConversionContext ctx{options};
+        ConversionStats stats;
+        ctx.stats = &stats;
+        // identical source images across tiles are encoded once
+        std::unique_ptr<TextureStore> textures;
+        if (options.shared_textures || options.texture_cache_bytes) {
+            std::string shared_dir = options.shared_textures ? (output / "Data" / "textures").string() : "";
+            textures.reset(new TextureStore(shared_dir, options.texture_cache_bytes));
+            ctx.textures = textures.get();
+        }
+        // draco encodes the primitives of a tile in parallel, the encode
+        // threads help run them while they wait
+        std::unique_ptr<ThreadPool> pool;
+        if (options.geometry_codec == GeometryCodec::draco) {
+            pool.reset(new ThreadPool(threads));
+            ctx.pool = pool.get();
+        }
+        TilePipeline pipeline(run_options.resolved(threads), ctx);
+        ctx.pipeline = &pipeline;
+        // every block goes in at once, the pipeline converts the coarse
+        // levels of all of them before the finer ones, costliest block first
+        std::vector<TileLatch> latches(blocks.size());
+        for (size_t i = 0; i < blocks.size(); i++) {
+            if (tile_in_range(roots[i], ctx)) {
+                latches[i].add();
+                pipeline.submit(&roots[i], out_dirs[i].string(), &latches[i], (unsigned)i);
+            }
+        }
+        // rewrite the tilesets each time a level is done in every block, the
+        // model is viewable long before the finest level is converted
+        int lvl = INT_MIN;
+        while ((lvl = pipeline.wait_level(lvl)) != TilePipeline::all_levels) {
+            std::vector<TileResult> partial = collect_block_tilesets(roots, out_dirs, lvl, rad_x, rad_y, false);
+            if (!partial.empty()) {
+                std::cout << "level " << lvl << " done" << std::endl;
+                write_tilesets(output, partial, center_x, center_y);
+            }
+        }
+        for (size_t i = 0; i < blocks.size(); i++) {
+            latches[i].wait();
+            profile.block_seconds[blocks[i].stem] = latches[i].seconds();
+        }
+
+        if (pipeline.memory_ratio() > 0) {
+            profile.memory_ratio = pipeline.memory_ratio();
+            profile.peak_tile_bytes = pipeline.peak_tile_bytes();
+        }
+        profile.peak_budget_bytes = pipeline.peak_budget_bytes();
+        if (textures) {
+            std::cout << "textures: " << textures->encoded() << " encoded, "
+                      << textures->reused() << " reused" << std::endl;
+        }
+        uint64_t source_draws = stats.source_draws, draws = stats.draws;
+        if (source_draws > 0) {
+            double fewer = 100.0 * ((double)source_draws - (double)draws) / (double)source_draws;
+            std::cout << "draw calls: " << source_draws << " -> " << draws << " ("
+                      << std::fixed << std::setprecision(1) << fewer << "% fewer)"
+                      << std::defaultfloat << std::endl;
+        }
+    }
+    profile.peak_rss = process_peak_rss();
+    save_profile(profile_file, profile);
+
+    std::vector<TileResult> tiles = collect_block_tilesets(roots, out_dirs, TilePipeline::all_levels, rad_x, rad_y, true);
+    write_tilesets(output, tiles, center_x, center_y);
 }
\ No newline at end of file
@@ -13,14 +13,32 @@
 #include <string>
 #include <cstring>
 #include <algorithm>
+#include <filesystem>
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #define TINYGLTF_IMPLEMENTATION
 #include "tiny_gltf.h"
+// tile_stages.h includes tiny_gltf.h again, its implementation is done
+#undef STB_IMAGE_IMPLEMENTATION
+#undef TINYGLTF_IMPLEMENTATION
 #include "stb_image_write.h"
 #include "dxt_img.h"
+#include "image_resize.h"
+#include "texture_atlas.h"
+#include "mesh_quantize.h"
+#include "mesh_optimize.h"
+#include "meshopt_encoder.h"
+#include "draco_encoder.h"
+#include "jpeg_encoder.h"
+#include "basis_encoder.h"
+#include "webp_encoder.h"
+#include "texture_store.h"
+#include "ktx2.h"
 #include "tileset.h"
+#include "thread_pool.h"
+#include "tile_stages.h"
+#include "tile_pipeline.h"
 
 using namespace std;
 
@@ -31,9 +49,6 @@ using namespace std;
 #undef min
 #endif // max
 
-static bool b_pbr_texture = false;
-static float quality = 100.f;
-
 template<class T>
 void put_val(std::vector<unsigned char>& buf, T val) {
     buf.insert(buf.end(), (unsigned char*)&val, (unsigned char*)&val + sizeof(T));
@@ -44,79 +59,6 @@ void put_val(std::string& buf, T val) {
     buf.append((unsigned char*)&val, (unsigned char*)&val + sizeof(T));
 }
 
-void write_buf(void* context, void* data, int len) {
-    std::vector<char> *buf = (std::vector<char>*)context;
-    buf->insert(buf->end(), (char*)data, (char*)data + len);
-}
-
-struct TileBox
-{
-    std::vector<double> max;
-    std::vector<double> min;
-
-    void extend(double ratio) {
-        ratio /= 2;
-        double x = max[0] - min[0];
-        double y = max[1] - min[1];
-        double z = max[2] - min[2];
-        max[0] += x * ratio;
-        max[1] += y * ratio;
-        max[2] += z * ratio;
-
-        min[0] -= x * ratio;
-        min[1] -= y * ratio;
-        min[2] -= z * ratio;
-    }
-};
-
-struct osg_tree {
-    TileBox bbox;
-    double geometricError;
-    std::string file_name;
-    std::vector<osg_tree> sub_nodes;
-};
-
-class InfoVisitor : public osg::NodeVisitor
-{
-    std::string path;
-public:
-    InfoVisitor(std::string _path)
-    :osg::NodeVisitor(TRAVERSE_ALL_CHILDREN)
-    ,path(_path)
-    {}
-
-    ~InfoVisitor() {
-    }
-
-    void apply(osg::Geometry& geometry){
-        geometry_array.push_back(&geometry);
-        if (auto ss = geometry.getStateSet() ) {
-            osg::Texture* tex = dynamic_cast<osg::Texture*>(ss->getTextureAttribute(0, osg::StateAttribute::TEXTURE));
-            if (tex) {
-                texture_array.insert(tex);
-                texture_map[&geometry] = tex;
-            }
-        }
-    }
-
-    void apply(osg::PagedLOD& node) {
-        //std::string path = node.getDatabasePath();
-        int n = node.getNumFileNames();
-        for (size_t i = 1; i < n; i++)
-        {
-            std::string file_name = path + "/" + node.getFileName(i);
-            sub_node_names.push_back(file_name);
-        }
-        traverse(node);
-    }
-
-public:
-    std::vector<osg::Geometry*> geometry_array;
-    std::set<osg::Texture*> texture_array;
-    std::map<osg::Geometry*, osg::Texture*> texture_map;
-    std::vector<std::string> sub_node_names;
-};
-
 double get_geometric_error(TileBox& bbox){
     if (bbox.max.empty() || bbox.min.empty())
     {
@@ -198,38 +140,6 @@ int get_lvl_num(std::string file_name){
     return -1;
 }
 
-osg_tree get_all_tree(std::string& file_name) {
-    osg_tree root_tile;
-    vector<string> fileNames = { file_name };
-
-    InfoVisitor infoVisitor(get_parent(file_name));
-    {   // add block to release Node
-        osg::ref_ptr<osg::Node> root = osgDB::readNodeFiles(fileNames);
-        if (!root) {
-            std::string name = utf8_string(file_name.c_str());
-            LOG_E("read node files [%s] fail!", name.c_str());
-            return root_tile;
-        }
-        root_tile.file_name = file_name;
-        root->accept(infoVisitor);
-    }
-
-    for (auto& i : infoVisitor.sub_node_names) {
-        osg_tree tree = get_all_tree(i);
-        if (!tree.file_name.empty()) {
-            root_tile.sub_nodes.push_back(tree);
-        }
-    }
-    return root_tile;
-}
-
-struct MeshInfo
-{
-    string name;
-    std::vector<double> min;
-    std::vector<double> max;
-};
-
 template<class T>
 void alignment_buffer(std::vector<T>& buf) {
     while (buf.size() % 4 != 0) {
@@ -326,8 +236,8 @@ R"(
 }
 
 void make_gltf2_shader(tinygltf::Model& model, int mat_size, tinygltf::Buffer& buffer) {
-    model.extensionsRequired = { "KHR_techniques_webgl" };
-    model.extensionsUsed = { "KHR_techniques_webgl" };
+    model.extensionsRequired.push_back("KHR_techniques_webgl");
+    model.extensionsUsed.push_back("KHR_techniques_webgl");
     // add vs shader
     {
         tinygltf::BufferView bfv_vs;
@@ -419,16 +329,6 @@ tinygltf::Material make_color_material_osgb(double r, double g, double b) {
     return material;
 }
 
-struct OsgBuildState
-{
-    tinygltf::Buffer* buffer;
-    tinygltf::Model* model;
-    osg::Vec3f point_max;
-    osg::Vec3f point_min;
-    int draw_array_first;
-    int draw_array_count;
-};
-
 void expand_bbox3d(osg::Vec3f& point_max, osg::Vec3f& point_min, osg::Vec3f point)
 {
     point_max.x() = std::max(point.x(), point_max.x());
@@ -439,164 +339,190 @@ void expand_bbox3d(osg::Vec3f& point_max, osg::Vec3f& point_min, osg::Vec3f poin
     point_min.z() = std::min(point.z(), point_min.z());
 }
 
-void expand_bbox2d(osg::Vec2f& point_max, osg::Vec2f& point_min, osg::Vec2f point)
-{
-    point_max.x() = std::max(point.x(), point_max.x());
-    point_min.x() = std::min(point.x(), point_min.x());
-    point_max.y() = std::max(point.y(), point_max.y());
-    point_min.y() = std::min(point.y(), point_min.y());
+// one buffer view for the bytes appended since buffer_start
+static int add_buffer_view(tinygltf::Model& model, tinygltf::Buffer& buffer, size_t buffer_start, int target,
+                           int byte_stride = 0) {
+    alignment_buffer(buffer.data);
+    tinygltf::BufferView bfv;
+    bfv.buffer = 0;
+    bfv.target = target;
+    bfv.byteStride = byte_stride;
+    bfv.byteOffset = buffer_start;
+    bfv.byteLength = buffer.data.size() - buffer_start;
+    model.bufferViews.push_back(bfv);
+    return model.bufferViews.size() - 1;
 }
 
-template<class T> void
-write_osg_indecis(T* drawElements, OsgBuildState* osgState, int componentType)
+// indices as unsigned short when the vertices allow it, unsigned int otherwise
+int write_indices(const uint32_t* indices, size_t count, size_t vertex_count, tinygltf::Model& model, tinygltf::Buffer& buffer)
 {
     unsigned max_index = 0;
     unsigned min_index = 1 << 30;
-    unsigned buffer_start = osgState->buffer->data.size();
-
-    unsigned IndNum = drawElements->getNumIndices();
-    for (unsigned m = 0; m < IndNum; m++)
+    size_t buffer_start = buffer.data.size();
+    bool wide = vertex_count > 65535;
+    for (size_t i = 0; i < count; i++)
     {
-        auto idx = drawElements->at(m);
-        put_val(osgState->buffer->data, idx);
+        uint32_t idx = indices[i];
+        if (wide) put_val(buffer.data, idx);
+        else put_val(buffer.data, (unsigned short)idx);
         if (idx > max_index) max_index = idx;
         if (idx < min_index) min_index = idx;
     }
-    alignment_buffer(osgState->buffer->data);
 
     tinygltf::Accessor acc;
-    acc.bufferView = osgState->model->bufferViews.size();
+    acc.bufferView = add_buffer_view(model, buffer, buffer_start, TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER);
     acc.type = TINYGLTF_TYPE_SCALAR;
-    acc.componentType = componentType;
-    acc.count = IndNum;
+    acc.componentType = wide ? TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT : TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT;
+    acc.count = count;
     acc.maxValues = { (double)max_index };
     acc.minValues = { (double)min_index };
-    osgState->model->accessors.push_back(acc);
-
-    tinygltf::BufferView bfv;
-    bfv.buffer = 0;
-    bfv.target = TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER;
-    bfv.byteOffset = buffer_start;
-    bfv.byteLength = osgState->buffer->data.size() - buffer_start;
-    osgState->model->bufferViews.push_back(bfv);
+    model.accessors.push_back(acc);
+    return model.accessors.size() - 1;
 }
 
-void
-write_vec3_array(osg::Vec3Array* v3f, OsgBuildState* osgState, osg::Vec3f& point_max, osg::Vec3f& point_min)
+// float attribute with `components` values per vertex and its bounds
+static int write_float_array(const std::vector<float>& values, int components, int type,
+                             tinygltf::Model& model, tinygltf::Buffer& buffer)
 {
-    int vec_start = 0;
-    int vec_end   = v3f->size();
-    if (osgState->draw_array_first >= 0)
-    {
-        vec_start = osgState->draw_array_first;
-        vec_end   = osgState->draw_array_count + vec_start;
-    }
-    unsigned buffer_start = osgState->buffer->data.size();
-    for (int vidx = vec_start; vidx < vec_end; vidx++)
+    std::vector<double> point_max(components, -1e38);
+    std::vector<double> point_min(components, 1e38);
+    size_t buffer_start = buffer.data.size();
+    for (size_t i = 0; i < values.size(); i++)
     {
-        osg::Vec3f point = v3f->at(vidx);
-        put_val(osgState->buffer->data, point.x());
-        put_val(osgState->buffer->data, point.y());
-        put_val(osgState->buffer->data, point.z());
-        expand_bbox3d(point_max, point_min, point);
+        int c = i % components;
+        point_max[c] = std::max(point_max[c], (double)values[i]);
+        point_min[c] = std::min(point_min[c], (double)values[i]);
     }
-    alignment_buffer(osgState->buffer->data);
+    const unsigned char* bytes = (const unsigned char*)values.data();
+    buffer.data.insert(buffer.data.end(), bytes, bytes + values.size() * sizeof(float));
 
     tinygltf::Accessor acc;
-    acc.bufferView = osgState->model->bufferViews.size();
-    acc.count = vec_end - vec_start;
+    acc.bufferView = add_buffer_view(model, buffer, buffer_start, TINYGLTF_TARGET_ARRAY_BUFFER);
+    acc.count = values.size() / components;
     acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-    acc.type = TINYGLTF_TYPE_VEC3;
-    acc.maxValues = {point_max.x(), point_max.y(), point_max.z()};
-    acc.minValues = {point_min.x(), point_min.y(), point_min.z()};
-    osgState->model->accessors.push_back(acc);
+    acc.type = type;
+    acc.maxValues = point_max;
+    acc.minValues = point_min;
+    model.accessors.push_back(acc);
+    return model.accessors.size() - 1;
+}
 
-    tinygltf::BufferView bfv;
-    bfv.buffer = 0;
-    bfv.target = TINYGLTF_TARGET_ARRAY_BUFFER;
-    bfv.byteOffset = buffer_start;
-    bfv.byteLength = osgState->buffer->data.size() - buffer_start;
-    osgState->model->bufferViews.push_back(bfv);
+int write_vec3_array(const std::vector<float>& values, tinygltf::Model& model, tinygltf::Buffer& buffer)
+{
+    return write_float_array(values, 3, TINYGLTF_TYPE_VEC3, model, buffer);
 }
 
-void
-write_vec2_array(osg::Vec2Array* v2f, OsgBuildState* osgState)
+int write_vec2_array(const std::vector<float>& values, tinygltf::Model& model, tinygltf::Buffer& buffer)
 {
-    int vec_start = 0;
-    int vec_end   = v2f->size();
-    if (osgState->draw_array_first >= 0)
-    {
-        vec_start = osgState->draw_array_first;
-        vec_end   = osgState->draw_array_count + vec_start;
-    }
-    osg::Vec2f point_max(-1e38, -1e38);
-    osg::Vec2f point_min(1e38, 1e38);
-    unsigned buffer_start = osgState->buffer->data.size();
-    for (int vidx = vec_start; vidx < vec_end; vidx++)
+    return write_float_array(values, 2, TINYGLTF_TYPE_VEC2, model, buffer);
+}
+
+// KHR_mesh_quantization attribute: `components` integers per vertex out
+// of `stride` stored, with the bounds of the stored values
+template<class T>
+static int write_quantized_array(const std::vector<T>& values, int components, int stride, int type,
+                                 int component_type, bool normalized,
+                                 tinygltf::Model& model, tinygltf::Buffer& buffer)
+{
+    std::vector<double> point_max(components, -1e38);
+    std::vector<double> point_min(components, 1e38);
+    size_t buffer_start = buffer.data.size();
+    for (size_t i = 0; i < values.size(); i += stride)
     {
-        osg::Vec2f point = v2f->at(vidx);
-        put_val(osgState->buffer->data, point.x());
-        put_val(osgState->buffer->data, point.y());
-        expand_bbox2d(point_max, point_min, point);
+        for (int c = 0; c < components; c++)
+        {
+            point_max[c] = std::max(point_max[c], (double)values[i + c]);
+            point_min[c] = std::min(point_min[c], (double)values[i + c]);
+        }
     }
-    alignment_buffer(osgState->buffer->data);
+    const unsigned char* bytes = (const unsigned char*)values.data();
+    buffer.data.insert(buffer.data.end(), bytes, bytes + values.size() * sizeof(T));
 
     tinygltf::Accessor acc;
-    acc.bufferView = osgState->model->bufferViews.size();
-    acc.count = vec_end - vec_start;
-    acc.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-    acc.type = TINYGLTF_TYPE_VEC2;
-    acc.maxValues = {point_max.x(), point_max.y()};
-    acc.minValues = {point_min.x(), point_min.y()};
-    osgState->model->accessors.push_back(acc);
-
-    tinygltf::BufferView bfv;
-    bfv.buffer = 0;
-    bfv.target = TINYGLTF_TARGET_ARRAY_BUFFER;
-    bfv.byteOffset = buffer_start;
-    bfv.byteLength = osgState->buffer->data.size() - buffer_start;
-    osgState->model->bufferViews.push_back(bfv);
+    acc.bufferView = add_buffer_view(model, buffer, buffer_start, TINYGLTF_TARGET_ARRAY_BUFFER, stride * sizeof(T));
+    acc.count = values.size() / stride;
+    acc.componentType = component_type;
+    acc.normalized = normalized;
+    acc.type = type;
+    acc.maxValues = point_max;
+    acc.minValues = point_min;
+    model.accessors.push_back(acc);
+    return model.accessors.size() - 1;
 }
 
-struct PrimitiveState
+// the osg arrays of one geometry, normals and texcoords only when there
+// is one per vertex
+struct OsgArrays
 {
-    int vertexAccessor;
-    int normalAccessor;
-    int textcdAccessor;
+    osg::Vec3Array* vertices;
+    osg::Vec3Array* normals;
+    osg::Vec2Array* texcoords;
 };
 
+static void append_vertex(const OsgArrays& arrays, unsigned i, MeshPrimitive& primitive)
+{
+    const osg::Vec3f& point = arrays.vertices->at(i);
+    primitive.positions.insert(primitive.positions.end(), { point.x(), point.y(), point.z() });
+    if (arrays.normals) {
+        const osg::Vec3f& normal = arrays.normals->at(i);
+        primitive.normals.insert(primitive.normals.end(), { normal.x(), normal.y(), normal.z() });
+    }
+    if (arrays.texcoords) {
+        const osg::Vec2f& uv = arrays.texcoords->at(i);
+        primitive.texcoords.insert(primitive.texcoords.end(), { uv.x(), uv.y() });
+    }
+}
+
+// append an index list to the geometry's primitive, each vertex copied on
+// its first use through remap; false on an index outside the vertex array
+template<class T> bool
+read_osg_indecis(const T* drawElements, const OsgArrays& arrays, std::vector<int>& remap, MeshPrimitive& primitive)
+{
+    unsigned IndNum = drawElements->getNumIndices();
+    primitive.indices.reserve(primitive.indices.size() + IndNum);
+    for (unsigned m = 0; m < IndNum; m++)
+    {
+        unsigned idx = drawElements->at(m);
+        if (idx >= remap.size())
+            return false;
+        if (remap[idx] < 0) {
+            remap[idx] = primitive.vertex_count();
+            append_vertex(arrays, idx, primitive);
+        }
+        primitive.indices.push_back(remap[idx]);
+    }
+    return true;
+}
+
+// one primitive set as the next draw of the geometry's primitive
 void
-write_element_array_primitive(osg::Geometry* g, osg::PrimitiveSet* ps, OsgBuildState* osgState, PrimitiveState* pmtState)
+read_element_array_primitive(osg::PrimitiveSet* ps, const OsgArrays& arrays, std::vector<int>& remap, MeshPrimitive& primitive)
 {
-    tinygltf::Primitive primits;
-    // indecis
-    primits.indices = osgState->model->accessors.size();
-    // reset draw_array state
-    osgState->draw_array_first = -1;
+    size_t first_index = primitive.indices.size();
+    bool ok = true;
     osg::PrimitiveSet::Type t = ps->getType();
     switch (t)
     {
         case(osg::PrimitiveSet::DrawElementsUBytePrimitiveType):
         {
             const osg::DrawElementsUByte* drawElements = static_cast<const osg::DrawElementsUByte*>(ps);
-            write_osg_indecis(drawElements, osgState, TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE);
+            ok = read_osg_indecis(drawElements, arrays, remap, primitive);
             break;
         }
         case(osg::PrimitiveSet::DrawElementsUShortPrimitiveType):
         {
             const osg::DrawElementsUShort* drawElements = static_cast<const osg::DrawElementsUShort*>(ps);
-            write_osg_indecis(drawElements, osgState, TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT);
+            ok = read_osg_indecis(drawElements, arrays, remap, primitive);
             break;
         }
         case(osg::PrimitiveSet::DrawElementsUIntPrimitiveType):
         {
             const osg::DrawElementsUInt* drawElements = static_cast<const osg::DrawElementsUInt*>(ps);
-            write_osg_indecis(drawElements, osgState, TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT);
+            ok = read_osg_indecis(drawElements, arrays, remap, primitive);
             break;
         }
         case osg::PrimitiveSet::DrawArraysPrimitiveType:
         {
-            primits.indices = -1;
             osg::DrawArrays* da = dynamic_cast<osg::DrawArrays*>(ps);
             auto mode = da->getMode();
             if (mode != GL_TRIANGLES)
@@ -604,8 +530,21 @@ write_element_array_primitive(osg::Geometry* g, osg::PrimitiveSet* ps, OsgBuildS
                 LOG_E("GLenum is not GL_TRIANGLES in osgb");
                 exit(1);
             }
-            osgState->draw_array_first = da->getFirst();
-            osgState->draw_array_count = da->getCount();
+            unsigned first = da->getFirst();
+            unsigned count = da->getCount();
+            if (first + count > remap.size()) {
+                ok = false;
+                break;
+            }
+            primitive.indices.reserve(primitive.indices.size() + count);
+            for (unsigned i = first; i < first + count; i++)
+            {
+                if (remap[i] < 0) {
+                    remap[i] = primitive.vertex_count();
+                    append_vertex(arrays, i, primitive);
+                }
+                primitive.indices.push_back(remap[i]);
+            }
             break;
         }
         default:
@@ -615,218 +554,872 @@ write_element_array_primitive(osg::Geometry* g, osg::PrimitiveSet* ps, OsgBuildS
             break;
         }
     }
-    // vertex: full vertex and part indecis
-    if (pmtState->vertexAccessor > -1 && osgState->draw_array_first == -1)
-    {
-        primits.attributes["POSITION"] = pmtState->vertexAccessor;
+    if (!ok) {
+        LOG_E("index out of the vertex array in osgb, primitive skipped");
+        // vertices it already copied stay, unreferenced unless a later set uses them
+        primitive.indices.resize(first_index);
+        return;
     }
-    else
+    if (primitive.indices.size() > first_index)
+        primitive.draw_ends.push_back(primitive.indices.size());
+}
+
+// every primitive set of g as one draw of a single primitive, all of them
+// indexing one copy of the geometry's vertices
+void read_osgGeometry(osg::Geometry* g, int material, std::vector<MeshPrimitive>& primitives)
+{
+    OsgArrays arrays;
+    arrays.vertices = (osg::Vec3Array*)g->getVertexArray();
+    arrays.normals = (osg::Vec3Array*)g->getNormalArray();
+    arrays.texcoords = (osg::Vec2Array*)g->getTexCoordArray(0);
+    if (arrays.normals && arrays.normals->size() < arrays.vertices->size())
+        arrays.normals = nullptr;
+    if (arrays.texcoords && arrays.texcoords->size() < arrays.vertices->size())
+        arrays.texcoords = nullptr;
+
+    MeshPrimitive primitive;
+    primitive.material = material;
+    // one table for all sets, vertices they share are copied once
+    std::vector<int> remap(arrays.vertices->size(), -1);
+    osg::PrimitiveSet::Type t = g->getPrimitiveSet(0)->getType();
+    for (unsigned int k = 0; k < g->getNumPrimitiveSets(); k++)
     {
-        osg::Vec3f point_max(-1e38, -1e38, -1e38);
-        osg::Vec3f point_min(1e38, 1e38, 1e38);
-        osg::Vec3Array* vertexArr = (osg::Vec3Array*)g->getVertexArray();
-        primits.attributes["POSITION"] = osgState->model->accessors.size();
-        // reuse vertex accessor if multi indecis
-        if (pmtState->vertexAccessor == -1 && osgState->draw_array_first == -1)
+        osg::PrimitiveSet* ps = g->getPrimitiveSet(k);
+        if (t != ps->getType())
         {
-            pmtState->vertexAccessor = osgState->model->accessors.size();
+            LOG_E("PrimitiveSets type are NOT same in osgb");
+            exit(1);
         }
-        write_vec3_array(vertexArr, osgState, point_max, point_min);
-        // merge mesh bbox
-        expand_bbox3d(osgState->point_max, osgState->point_min, point_max);
-        expand_bbox3d(osgState->point_max, osgState->point_min, point_min);
-    }
-    // normal
-    osg::Vec3Array* normalArr = (osg::Vec3Array*)g->getNormalArray();
-    if (normalArr)
+        read_element_array_primitive(ps, arrays, remap, primitive);
+    }
+    if (primitive.indices.empty())
+        return;
+    if (primitive.draw_ends.size() == 1)
+        primitive.draw_ends.clear();
+    primitives.push_back(std::move(primitive));
+}
+
+osg::ref_ptr<osg::Node> read_osgb(const std::string& path) {
+    vector<string> fileNames = { path };
+    return osgDB::readNodeFiles(fileNames);
+}
+
+bool build_glb_geometry(TileBuild& build, const ConversionContext& ctx) {
+    InfoVisitor& infoVisitor = build.info;
+    build.root->accept(infoVisitor);
+    if (infoVisitor.geometry_array.empty())
+        return false;
+
+    osgUtil::SmoothingVisitor sv;
+    build.root->accept(sv);
+
+    // material i is texture i, in texture_array order
+    std::map<osg::Texture*, int> materials;
+    for (auto tex : infoVisitor.texture_array)
     {
-        if (pmtState->normalAccessor > -1 && osgState->draw_array_first == -1)
-        {
-            primits.attributes["NORMAL"] = pmtState->normalAccessor;
-        }
-        else
-        {
-            osg::Vec3f point_max(-1e38, -1e38, -1e38);
-            osg::Vec3f point_min(1e38, 1e38, 1e38);
-            primits.attributes["NORMAL"] = osgState->model->accessors.size();
-            // reuse vertex accessor if multi indecis
-            if (pmtState->normalAccessor == -1 && osgState->draw_array_first == -1)
-            {
-                pmtState->normalAccessor = osgState->model->accessors.size();
-            }
-            write_vec3_array(normalArr, osgState, point_max, point_min);
-        }
+        materials[tex] = build.images.size();
+        build.images.push_back(tex->getNumImages() > 0 ? tex->getImage(0) : nullptr);
     }
-    // textcoord
-    osg::Vec2Array* texArr = (osg::Vec2Array*)g->getTexCoordArray(0);
-    if (texArr)
+    for (auto g : infoVisitor.geometry_array)
     {
-        if (pmtState->textcdAccessor > -1 && osgState->draw_array_first == -1)
+        if (!g->getVertexArray() || g->getVertexArray()->getDataSize() == 0 || g->getNumPrimitiveSets() == 0)
+            continue;
+        auto tex = infoVisitor.texture_map.find(g);
+        int material = (tex != infoVisitor.texture_map.end()) ? materials[tex->second] : -1;
+        read_osgGeometry(g, material, build.primitives);
+    }
+    // empty geometry or empty vertex-array
+    if (build.primitives.empty())
+        return false;
+    build.source_primitives = 0;
+    for (auto& primitive : build.primitives)
+        build.source_primitives += primitive.draw_count();
+
+    osg::Vec3f point_max(-1e38, -1e38, -1e38);
+    osg::Vec3f point_min(1e38, 1e38, 1e38);
+    // the osg arrays and their copy, plus the textures as loaded
+    build.memory_bytes = 0;
+    for (auto& primitive : build.primitives)
+    {
+        for (size_t i = 0; i < primitive.positions.size(); i += 3)
         {
-            primits.attributes["TEXCOORD_0"] = pmtState->textcdAccessor;
+            osg::Vec3f point(primitive.positions[i], primitive.positions[i + 1], primitive.positions[i + 2]);
+            expand_bbox3d(point_max, point_min, point);
+        }
+        build.memory_bytes += primitive.byte_size() * 2;
+    }
+    build.mesh_info.min = { point_min.x(), point_min.y(), point_min.z() };
+    build.mesh_info.max = { point_max.x(), point_max.y(), point_max.z() };
+    for (auto& img : build.images) {
+        if (img) {
+            build.texture_pixels += (uint64_t)img->s() * img->t();
+            build.memory_bytes += img->getTotalSizeInBytes();
         }
+    }
+    return true;
+}
+
+// quantized attributes of one primitive, positions on the grid q
+static void write_quantized_primitive(const MeshPrimitive& primitive, const PositionQuantization& q,
+                                      tinygltf::Primitive& primits, tinygltf::Model& model, tinygltf::Buffer& buffer)
+{
+    std::vector<int16_t> positions;
+    quantize_positions(primitive.positions, q, positions);
+    primits.attributes["POSITION"] = write_quantized_array(positions, 3, 4, TINYGLTF_TYPE_VEC3,
+        TINYGLTF_COMPONENT_TYPE_SHORT, true, model, buffer);
+    if (!primitive.normals.empty()) {
+        std::vector<int8_t> normals;
+        quantize_normals(primitive.normals, normals);
+        primits.attributes["NORMAL"] = write_quantized_array(normals, 3, 4, TINYGLTF_TYPE_VEC3,
+            TINYGLTF_COMPONENT_TYPE_BYTE, true, model, buffer);
+    }
+    if (!primitive.texcoords.empty()) {
+        std::vector<uint16_t> texcoords;
+        if (quantize_texcoords(primitive.texcoords, texcoords))
+            primits.attributes["TEXCOORD_0"] = write_quantized_array(texcoords, 2, 2, TINYGLTF_TYPE_VEC2,
+                TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT, true, model, buffer);
         else
-        {
-            primits.attributes["TEXCOORD_0"] = osgState->model->accessors.size();
-            // reuse textcoord accessor if multi indecis
-            if (pmtState->textcdAccessor == -1 && osgState->draw_array_first == -1)
-            {
-                pmtState->textcdAccessor = osgState->model->accessors.size();
-            }
-            write_vec2_array(texArr, osgState);
+            primits.attributes["TEXCOORD_0"] = write_vec2_array(primitive.texcoords, model, buffer);
+    }
+}
+
+// Compress the geometry views (the accessors from first_accessor on, their
+// data from geometry_start to the end of the buffer) with
+// EXT_meshopt_compression. Without a fallback the plain data moves out of
+// the glb into a data-less fallback buffer (buffer 1) and the extension is
+// required; with one it stays and the extension is optional.
+// A view that fails to encode leaves the whole tile uncompressed.
+static void encode_meshopt_views(TileBuild& build, const ConversionContext& ctx,
+                                 size_t first_accessor, size_t geometry_start) {
+    struct MeshoptView { int view; size_t offset; size_t length; size_t stride; size_t count; bool indices; };
+    tinygltf::Model& model = build.model;
+    tinygltf::Buffer& buffer = build.buffer;
+    std::vector<unsigned char> compressed;
+    std::vector<MeshoptView> views;
+    for (size_t a = first_accessor; a < model.accessors.size(); a++) {
+        const tinygltf::Accessor& acc = model.accessors[a];
+        const tinygltf::BufferView& bfv = model.bufferViews[acc.bufferView];
+        MeshoptView view{acc.bufferView, compressed.size(), 0, (size_t)acc.ByteStride(bfv), acc.count,
+                         bfv.target == TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER};
+        const unsigned char* data = buffer.data.data() + bfv.byteOffset;
+        bool ok = view.indices ? meshopt_encode_triangles(data, view.count, view.stride, compressed)
+                               : meshopt_encode_attributes(data, view.count, view.stride, compressed);
+        if (!ok) {
+            LOG_E("meshopt encode of [%s] failed, geometry left uncompressed", build.path.c_str());
+            return;
+        }
+        // the decoder finds the stream tail from its exact length
+        view.length = compressed.size() - view.offset;
+        alignment_buffer(compressed);
+        views.push_back(view);
+    }
+    size_t compressed_start = geometry_start;
+    if (ctx.options.geometry_fallback) {
+        compressed_start = buffer.data.size();
+    }
+    else {
+        build.fallback_bytes = buffer.data.size() - geometry_start;
+        buffer.data.resize(geometry_start);
+    }
+    buffer.data.insert(buffer.data.end(), compressed.begin(), compressed.end());
+    for (auto& view : views) {
+        tinygltf::BufferView& bfv = model.bufferViews[view.view];
+        nlohmann::json ext;
+        ext["EXT_meshopt_compression"] = {
+            {"buffer", 0},
+            {"byteOffset", compressed_start + view.offset},
+            {"byteLength", view.length},
+            {"byteStride", view.stride},
+            {"count", view.count},
+            {"mode", view.indices ? "TRIANGLES" : "ATTRIBUTES"},
+        };
+        bfv.extensions = ext.dump();
+        if (!ctx.options.geometry_fallback) {
+            bfv.buffer = 1;
+            bfv.byteOffset -= geometry_start;
         }
     }
-    // material
-    primits.material = -1;
+    model.extensionsUsed.push_back("EXT_meshopt_compression");
+    if (!ctx.options.geometry_fallback)
+        model.extensionsRequired.push_back("EXT_meshopt_compression");
+}
 
-    primits.mode = TINYGLTF_MODE_TRIANGLES;
-    osgState->model->meshes.back().primitives.push_back(primits);
+// accessor of a draco compressed attribute: no buffer view, only what the
+// stream decodes to
+static int add_draco_accessor(size_t count, int component_type, int type, tinygltf::Model& model)
+{
+    tinygltf::Accessor acc;
+    acc.count = count;
+    acc.componentType = component_type;
+    acc.type = type;
+    model.accessors.push_back(acc);
+    return model.accessors.size() - 1;
 }
 
-void write_osgGeometry(osg::Geometry* g, OsgBuildState* osgState)
+// KHR_draco_mesh_compression primitive, the stream as one buffer view.
+// With a fallback the plain accessors are written as well, without one
+// the accessors only describe the decoded data.
+static void write_draco_primitive(const MeshPrimitive& primitive, const DracoMesh& mesh, bool fallback,
+                                  tinygltf::Primitive& primits, tinygltf::Model& model, tinygltf::Buffer& buffer)
 {
-    osg::PrimitiveSet::Type t = g->getPrimitiveSet(0)->getType();
-    PrimitiveState pmtState = {-1, -1, -1};
-    for (unsigned int k = 0; k < g->getNumPrimitiveSets(); k++)
+    size_t buffer_start = buffer.data.size();
+    buffer.data.insert(buffer.data.end(), mesh.data.begin(), mesh.data.end());
+    int view = add_buffer_view(model, buffer, buffer_start, 0);
+    if (fallback) {
+        primits.indices = write_indices(primitive.indices.data(), primitive.indices.size(), primitive.vertex_count(), model, buffer);
+        primits.attributes["POSITION"] = write_vec3_array(primitive.positions, model, buffer);
+        if (!primitive.normals.empty())
+            primits.attributes["NORMAL"] = write_vec3_array(primitive.normals, model, buffer);
+        if (!primitive.texcoords.empty())
+            primits.attributes["TEXCOORD_0"] = write_vec2_array(primitive.texcoords, model, buffer);
+    }
+    else {
+        int index_type = mesh.point_count > 65535 ? TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT : TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT;
+        primits.indices = add_draco_accessor(mesh.index_count, index_type, TINYGLTF_TYPE_SCALAR, model);
+        primits.attributes["POSITION"] = add_draco_accessor(mesh.point_count, TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC3, model);
+        // positions need their bounds
+        tinygltf::Accessor& position = model.accessors.back();
+        position.minValues = { 1e38, 1e38, 1e38 };
+        position.maxValues = { -1e38, -1e38, -1e38 };
+        for (size_t i = 0; i < primitive.positions.size(); i++) {
+            position.minValues[i % 3] = std::min(position.minValues[i % 3], (double)primitive.positions[i]);
+            position.maxValues[i % 3] = std::max(position.maxValues[i % 3], (double)primitive.positions[i]);
+        }
+        if (mesh.normal >= 0)
+            primits.attributes["NORMAL"] = add_draco_accessor(mesh.point_count, TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC3, model);
+        if (mesh.texcoord >= 0)
+            primits.attributes["TEXCOORD_0"] = add_draco_accessor(mesh.point_count, TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC2, model);
+    }
+    nlohmann::json attributes;
+    attributes["POSITION"] = mesh.position;
+    if (mesh.normal >= 0) attributes["NORMAL"] = mesh.normal;
+    if (mesh.texcoord >= 0) attributes["TEXCOORD_0"] = mesh.texcoord;
+    nlohmann::json ext;
+    ext["KHR_draco_mesh_compression"] = { {"bufferView", view}, {"attributes", attributes} };
+    primits.extensions = ext.dump();
+}
+
+// Draco stream of every primitive, encoded in parallel on the conversion
+// pool; ok[i] is false where the encoder failed
+static void encode_draco_primitives(const TileBuild& build, const ConversionContext& ctx,
+                                    std::vector<DracoMesh>& meshes, std::vector<char>& ok)
+{
+    DracoOptions options;
+    options.position_bits = ctx.options.draco_position_bits;
+    options.normal_bits = ctx.options.draco_normal_bits;
+    options.texcoord_bits = ctx.options.draco_texcoord_bits;
+    // the fallback accessors describe the decoded stream too
+    options.keep_point_count = ctx.options.geometry_fallback;
+    meshes.resize(build.primitives.size());
+    ok.assign(build.primitives.size(), 0);
+    TaskGroup group(ctx.pool);
+    for (size_t i = 0; i < build.primitives.size(); i++) {
+        group.run([&build, &options, &meshes, &ok, i]() {
+            ok[i] = encode_draco_mesh(build.primitives[i], options, meshes[i]);
+        });
+    }
+    group.wait();
+}
+
+void encode_glb_geometry(TileBuild& build, const ConversionContext& ctx) {
+    tinygltf::Model& model = build.model;
+    tinygltf::Buffer& buffer = build.buffer;
+    alignment_buffer(buffer.data);
+    size_t geometry_start = buffer.data.size();
+    size_t first_accessor = model.accessors.size();
+    model.meshes.resize(1);
+    if (ctx.options.merge_primitives) {
+        std::set<int> materials;
+        for (auto& primitive : build.primitives) materials.insert(primitive.material);
+        merge_primitives(build.primitives, materials);
+    }
+    // triangle and vertex order first, quantization and the codecs work
+    // on the reordered streams
+    if (ctx.options.optimize_mesh) {
+        for (auto& primitive : build.primitives) {
+            optimize_vertex_cache(primitive, ctx.options.optimize_overdraw);
+            optimize_vertex_fetch(primitive);
+        }
+    }
+    bool draco = ctx.options.geometry_codec == GeometryCodec::draco;
+    std::vector<DracoMesh> draco_meshes;
+    std::vector<char> draco_ok;
+    if (draco) {
+        encode_draco_primitives(build, ctx, draco_meshes, draco_ok);
+        model.extensionsUsed.push_back("KHR_draco_mesh_compression");
+        if (!ctx.options.geometry_fallback)
+            model.extensionsRequired.push_back("KHR_draco_mesh_compression");
+    }
+    // draco quantizes on its own
+    bool quantize = ctx.options.quantize && !draco;
+    PositionQuantization q;
+    if (quantize) {
+        int bits = ctx.options.quantize_bits(get_lvl_num(build.path));
+        q = position_quantization(build.mesh_info.min.data(), build.mesh_info.max.data(), bits);
+        // the node maps the grid back to the tile coordinates
+        build.translation = { q.offset[0], q.offset[1], q.offset[2] };
+        build.scale = { q.scale, q.scale, q.scale };
+        model.extensionsUsed.push_back("KHR_mesh_quantization");
+        model.extensionsRequired.push_back("KHR_mesh_quantization");
+    }
+    for (size_t i = 0; i < build.primitives.size(); i++)
     {
-        osg::PrimitiveSet* ps = g->getPrimitiveSet(k);
-        if (t != ps->getType())
-        {
-            LOG_E("PrimitiveSets type are NOT same in osgb");
-            exit(1);
+        const MeshPrimitive& primitive = build.primitives[i];
+        tinygltf::Primitive primits;
+        primits.material = primitive.material;
+        primits.mode = TINYGLTF_MODE_TRIANGLES;
+        if (draco && draco_ok[i]) {
+            write_draco_primitive(primitive, draco_meshes[i], ctx.options.geometry_fallback, primits, model, buffer);
+            model.meshes[0].primitives.push_back(primits);
+            continue;
+        }
+        if (draco) {
+            LOG_E("draco encode of [%s] failed, primitive left uncompressed", build.path.c_str());
+        }
+        if (quantize) {
+            write_quantized_primitive(primitive, q, primits, model, buffer);
+        }
+        else {
+            primits.attributes["POSITION"] = write_vec3_array(primitive.positions, model, buffer);
+            if (!primitive.normals.empty())
+                primits.attributes["NORMAL"] = write_vec3_array(primitive.normals, model, buffer);
+            if (!primitive.texcoords.empty())
+                primits.attributes["TEXCOORD_0"] = write_vec2_array(primitive.texcoords, model, buffer);
+        }
+        // the draws of one geometry share its attribute accessors
+        size_t first_index = 0;
+        for (size_t d = 0; d < primitive.draw_count(); d++) {
+            size_t end = primitive.draw_ends.empty() ? primitive.indices.size() : primitive.draw_ends[d];
+            primits.indices = write_indices(primitive.indices.data() + first_index, end - first_index,
+                                            primitive.vertex_count(), model, buffer);
+            model.meshes[0].primitives.push_back(primits);
+            first_index = end;
         }
-        write_element_array_primitive(g, ps, osgState, &pmtState);
+    }
+    if (ctx.stats) {
+        ctx.stats->source_draws += build.source_primitives;
+        ctx.stats->draws += model.meshes[0].primitives.size();
+    }
+    // the buffer holds them now
+    std::vector<MeshPrimitive>().swap(build.primitives);
+    if (ctx.options.geometry_codec == GeometryCodec::meshopt) {
+        encode_meshopt_views(build, ctx, first_accessor, geometry_start);
     }
 }
 
-bool osgb2glb_buf(std::string path, std::string& glb_buff, MeshInfo& mesh_info) {
-    vector<string> fileNames = { path };
-    std::string parent_path = get_parent(path);
-    osg::ref_ptr<osg::Node> root = osgDB::readNodeFiles(fileNames);
-    if (!root.valid()) {
+// image in the buffer as one buffer view, returns its index in model.images
+static int add_buffer_image(tinygltf::Model& model, tinygltf::Buffer& buffer, size_t buffer_start, const char* mime_type) {
+    tinygltf::Image image;
+    image.mimeType = mime_type;
+    image.bufferView = model.bufferViews.size();
+    model.images.push_back(image);
+    tinygltf::BufferView bfv;
+    bfv.buffer = 0;
+    bfv.byteOffset = buffer_start;
+    alignment_buffer(buffer.data);
+    bfv.byteLength = buffer.data.size() - buffer_start;
+    model.bufferViews.push_back(bfv);
+    return model.images.size() - 1;
+}
+
+static bool is_dxt1(osg::Image* img) {
+    S3tcFormat format;
+    return s3tc_image_format(img, format)
+        && (format == S3tcFormat::dxt1 || format == S3tcFormat::dxt1a);
+}
+
+// copy the DXT1 blocks of img into a KTX2 image, false if they don't fit
+// the format. Full mip chains are kept, partial ones dropped to level 0.
+// Textures over max_size start at the first mip level that fits, without a
+// full chain they are left to the jpeg path to downscale.
+static bool encode_ktx2_passthrough(osg::Image* img, int max_size, EncodedImage& image) {
+    int width = img->s();
+    int height = img->t();
+    std::vector<Ktx2Level> levels;
+    unsigned full_chain = 1;
+    while ((std::max(width, height) >> full_chain) > 0) full_chain++;
+    unsigned num_levels = (img->getNumMipmapLevels() == full_chain) ? full_chain : 1;
+    unsigned base = 0;
+    while ((width >> base) > max_size || (height >> base) > max_size) base++;
+    if (base >= num_levels) {
         return false;
     }
-    InfoVisitor infoVisitor(parent_path);
-    root->accept(infoVisitor);
-    if (infoVisitor.geometry_array.empty())
+    const unsigned char* end = img->data() + img->getTotalSizeInBytes();
+    for (unsigned i = base; i < num_levels; i++) {
+        const unsigned char* data = (i == 0) ? img->data() : img->getMipmapData(i);
+        size_t size = bc1_level_size(std::max(1, width >> i), std::max(1, height >> i));
+        if (!data || data + size > end) {
+            return false;
+        }
+        levels.push_back(Ktx2Level{data, size});
+    }
+    bool alpha = img->getPixelFormat() == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+    if (!write_ktx2_bc1(image.data, std::max(1, width >> base), std::max(1, height >> base), levels, alpha)) {
         return false;
+    }
+    image.mipmapped = levels.size() > 1;
+    return true;
+}
 
-    osgUtil::SmoothingVisitor sv;
-    root->accept(sv);
-
-    tinygltf::TinyGLTF gltf;
-    tinygltf::Model model;
-    tinygltf::Buffer buffer;
+static JpegOptions jpeg_options(const ConversionOptions& options) {
+    JpegOptions jpeg;
+    jpeg.quality = (int)(options.quality * 100);
+    jpeg.subsampling = options.jpeg_subsampling;
+    jpeg.progressive = options.jpeg_progressive;
+    jpeg.optimize_huffman = options.jpeg_optimize;
+    return jpeg;
+}
 
-    osg::Vec3f point_max, point_min;
-    OsgBuildState osgState = {
-        &buffer, &model, osg::Vec3f(-1e38,-1e38,-1e38), osg::Vec3f(1e38,1e38,1e38), -1, -1
-    };
-    // mesh
-    model.meshes.resize(1);
-    int primitive_idx = 0;
-    for (auto g : infoVisitor.geometry_array)
+// pixels of the texture's first image fitted to max_size, data is null
+// without one. Images that need no decode and no resize are viewed in
+// place in the osg rows, the others are decoded/resized into pixels.
+static ImageView texture_view(osg::Image* img, int max_size, std::vector<unsigned char>& pixels) {
+    ImageView view{nullptr, 0, 0, 3, 0};
+    if (!img) {
+        return view;
+    }
+    int width = img->s();
+    int height = img->t();
+    int comp = img->getPixelSizeInBits() / 8;
+    S3tcFormat format;
+    if (s3tc_image_format(img, format)) {
+        fill_s3tc_image(pixels, img, format, max_size, width, height);
+        if (!pixels.empty()) view = ImageView{pixels.data(), width, height, 3, (size_t)width * 3};
+    }
+    else if (comp >= 1 && comp <= 4)
     {
-        if (!g->getVertexArray() || g->getVertexArray()->getDataSize() == 0)
+        int new_w, new_h;
+        fit_texture_size(width, height, max_size, new_w, new_h);
+        if (new_w == width && new_h == height) {
+            view = ImageView{img->data(), width, height, comp, img->getRowStepInBytes()};
+        }
+        else {
+            pixels.resize((size_t)new_w * new_h * comp);
+            resize_area(img->data(), width, height, img->getRowStepInBytes(), comp, pixels.data(), new_w, new_h);
+            view = ImageView{pixels.data(), new_w, new_h, comp, (size_t)new_w * comp};
+        }
+    }
+    return view;
+}
+
+// decoded on first use, textures found in the store are never decoded
+struct TexturePixels {
+    osg::Image* img;
+    int max_size;
+    std::vector<unsigned char> pixels;
+    ImageView view{nullptr, 0, 0, 3, 0};
+    bool decoded = false;
+
+    const ImageView& get() {
+        if (!decoded) {
+            view = texture_view(img, max_size, pixels);
+            decoded = true;
+        }
+        return view;
+    }
+};
+
+// jpeg of the view, a black 256x256 one without it
+static bool encode_jpeg_or_black(const ImageView& view, const ConversionContext& ctx, std::vector<unsigned char>& out) {
+    const JpegEncoder& encoder = jpeg_encoder(ctx.options.jpeg_backend);
+    JpegOptions options = jpeg_options(ctx.options);
+    if (!view.data || !encoder.encode(view, options, out)) {
+        std::vector<unsigned char> black(256 * 256 * 3);
+        encoder.encode(ImageView{black.data(), 256, 256, 3, 256 * 3}, options, out);
+    }
+    return true;
+}
+
+// a crop has to save this share of the texture area to be worth the copy
+static const double crop_min_saving = 0.2;
+// texels kept around the used region, at the size the texture is encoded
+static const int crop_padding = 4;
+
+// the w x h pixels of img at x/y as a new image of the same format, S3TC
+// images are cropped on whole blocks; null if img is short of data
+static osg::ref_ptr<osg::Image> crop_image(osg::Image* img, int x, int y, int w, int h) {
+    osg::ref_ptr<osg::Image> cropped = new osg::Image;
+    cropped->allocateImage(w, h, 1, img->getPixelFormat(), img->getDataType());
+    S3tcFormat format;
+    if (s3tc_image_format(img, format)) {
+        size_t block = s3tc_block_size(format);
+        size_t src_row = (size_t)((img->s() + 3) / 4) * block;
+        size_t dst_row = (size_t)((w + 3) / 4) * block;
+        if (src_row * ((img->t() + 3) / 4) > img->getTotalSizeInBytes()) {
+            return nullptr;
+        }
+        for (int by = 0; by < (h + 3) / 4; by++) {
+            memcpy(cropped->data() + by * dst_row, img->data() + (y / 4 + by) * src_row + (x / 4) * block, dst_row);
+        }
+    }
+    else {
+        size_t comp = img->getPixelSizeInBits() / 8;
+        for (int row = 0; row < h; row++) {
+            memcpy(cropped->data() + row * cropped->getRowStepInBytes(),
+                   img->data() + (size_t)(y + row) * img->getRowStepInBytes() + x * comp, w * comp);
+        }
+    }
+    return cropped;
+}
+
+// Crop every texture to the texel region its primitives' texcoords use,
+// plus padding, and rewrite those texcoords into the crop. Textures that
+// repeat (texcoords outside [0, 1]) or go out as DXT1 blocks with their
+// mip chain are left whole, as are crops that save too little.
+static void crop_textures_to_uv(TileBuild& build, const ConversionContext& ctx, int max_size) {
+    size_t count = build.images.size();
+    // umin, vmin, umax, vmax per texture
+    std::vector<float> bounds(count * 4);
+    for (size_t i = 0; i < count; i++) {
+        bounds[i * 4] = bounds[i * 4 + 1] = 1e30f;
+        bounds[i * 4 + 2] = bounds[i * 4 + 3] = -1e30f;
+    }
+    std::vector<char> croppable(count, 1);
+    for (auto& primitive : build.primitives) {
+        int m = primitive.material;
+        if (m < 0 || !croppable[m]) {
             continue;
+        }
+        if (primitive.texcoords.empty()) croppable[m] = 0;
+        for (size_t i = 0; croppable[m] && i < primitive.texcoords.size(); i++) {
+            float t = primitive.texcoords[i];
+            if (t < -0.001f || t > 1.001f) croppable[m] = 0;
+            float& lo = bounds[m * 4 + i % 2];
+            float& hi = bounds[m * 4 + 2 + i % 2];
+            lo = std::min(lo, t);
+            hi = std::max(hi, t);
+        }
+    }
 
-        write_osgGeometry(g, &osgState);
-        // update primitive material index
-        if (infoVisitor.texture_array.size())
-        {
-            for (unsigned int k = 0; k < g->getNumPrimitiveSets(); k++)
-            {
-                auto tex = infoVisitor.texture_map[g];
-                // if hava texture
-                if (tex)
-                {
-                    for (auto texture : infoVisitor.texture_array)
-                    {
-                        model.meshes[0].primitives[primitive_idx].material++;
-                        if (tex == texture)
-                            break;
-                    }
-                }
-                primitive_idx++;
-            }
+    // u' = u * scale_u + offset_u, v' likewise, per cropped texture
+    std::vector<float> remap(count * 4, 0.0f);
+    std::vector<char> cropped(count, 0);
+    for (size_t i = 0; i < count; i++) {
+        osg::Image* img = build.images[i].get();
+        if (!img || !croppable[i] || bounds[i * 4] > bounds[i * 4 + 2]) {
+            continue;
+        }
+        S3tcFormat format;
+        bool s3tc = s3tc_image_format(img, format);
+        int comp = img->getPixelSizeInBits() / 8;
+        if (s3tc ? (ctx.options.texture_format == TextureFormat::ktx2 && is_dxt1(img))
+                 : (comp < 1 || comp > 4 || img->getDataType() != GL_UNSIGNED_BYTE)) {
+            continue;
         }
+        int width = img->s();
+        int height = img->t();
+        int fitted_w, fitted_h;
+        fit_texture_size(width, height, max_size, fitted_w, fitted_h);
+        int pad_x = crop_padding * std::max(1, width / fitted_w);
+        int pad_y = crop_padding * std::max(1, height / fitted_h);
+        int x0 = std::max(0, (int)std::floor(bounds[i * 4] * width) - pad_x);
+        int y0 = std::max(0, (int)std::floor(bounds[i * 4 + 1] * height) - pad_y);
+        int x1 = std::min(width, (int)std::ceil(bounds[i * 4 + 2] * width) + pad_x);
+        int y1 = std::min(height, (int)std::ceil(bounds[i * 4 + 3] * height) + pad_y);
+        if (s3tc) {
+            x0 &= ~3;
+            y0 &= ~3;
+            x1 = std::min(width, (x1 + 3) & ~3);
+            y1 = std::min(height, (y1 + 3) & ~3);
+        }
+        if (x1 <= x0 || y1 <= y0
+            || (double)(x1 - x0) * (y1 - y0) > (1.0 - crop_min_saving) * width * height) {
+            continue;
+        }
+        osg::ref_ptr<osg::Image> image = crop_image(img, x0, y0, x1 - x0, y1 - y0);
+        if (!image) {
+            continue;
+        }
+        remap[i * 4] = (float)width / (x1 - x0);
+        remap[i * 4 + 1] = (float)height / (y1 - y0);
+        remap[i * 4 + 2] = -(float)x0 / (x1 - x0);
+        remap[i * 4 + 3] = -(float)y0 / (y1 - y0);
+        cropped[i] = 1;
+        build.memory_bytes += image->getTotalSizeInBytes();
+        build.images[i] = image;
     }
-    // empty geometry or empty vertex-array
-    if (model.meshes[0].primitives.empty())
-        return false;
+    for (auto& primitive : build.primitives) {
+        int m = primitive.material;
+        if (m < 0 || !cropped[m]) {
+            continue;
+        }
+        for (size_t i = 0; i < primitive.texcoords.size(); i++) {
+            float& t = primitive.texcoords[i];
+            t = t * remap[m * 4 + i % 2] + remap[m * 4 + 2 + i % 2];
+        }
+    }
+}
 
-    mesh_info.min = {
-        osgState.point_min.x(),
-        osgState.point_min.y(),
-        osgState.point_min.z()
-    };
-    mesh_info.max = {
-        osgState.point_max.x(),
-        osgState.point_max.y(),
-        osgState.point_max.z()
-    };
-    // image
+// pixels around each atlas texture, bilinear filtering and the first mip
+// levels stay inside its own texels
+static const int atlas_padding = 4;
+static const int max_atlases = 2;
+
+// Pack the textures of a tile into at most max_atlases RGB atlases of
+// max_size, remap TEXCOORD_0 of their primitives into the atlas and merge
+// the primitives of each atlas into one. Textures that repeat (texcoords
+// outside [0, 1]), carry alpha or go out as DXT1 blocks keep their own
+// material, as do atlases that would hold a single texture.
+static void pack_texture_atlases(TileBuild& build, const ConversionContext& ctx, int max_size) {
+    size_t count = build.images.size();
+    if (count < 2) {
+        return;
+    }
+    std::vector<char> eligible(count, 0);
+    for (size_t i = 0; i < count; i++) {
+        osg::Image* img = build.images[i].get();
+        S3tcFormat format;
+        if (!img) {
+            continue;
+        }
+        if (s3tc_image_format(img, format)) {
+            eligible[i] = !(ctx.options.texture_format == TextureFormat::ktx2 && is_dxt1(img));
+        }
+        else {
+            int comp = img->getPixelSizeInBits() / 8;
+            eligible[i] = (comp == 1 || comp == 3);
+        }
+    }
+    for (auto& primitive : build.primitives) {
+        if (primitive.material < 0 || !eligible[primitive.material]) {
+            continue;
+        }
+        bool inside = !primitive.texcoords.empty();
+        for (size_t i = 0; inside && i < primitive.texcoords.size(); i++) {
+            inside = primitive.texcoords[i] >= -0.001f && primitive.texcoords[i] <= 1.001f;
+        }
+        if (!inside) eligible[primitive.material] = 0;
+    }
+
+    std::vector<AtlasItem> items;
+    std::vector<int> item_image;
+    for (size_t i = 0; i < count; i++) {
+        if (!eligible[i]) continue;
+        AtlasItem item;
+        fit_texture_size(build.images[i]->s(), build.images[i]->t(), max_size, item.width, item.height);
+        items.push_back(item);
+        item_image.push_back(i);
+    }
+    if (items.size() < 2) {
+        return;
+    }
+    std::vector<AtlasSize> sizes = pack_atlases(items, max_size, atlas_padding, max_atlases);
+    std::vector<int> atlas_items(sizes.size(), 0);
+    for (auto& item : items) {
+        if (item.atlas >= 0) atlas_items[item.atlas]++;
+    }
+    std::vector<const AtlasItem*> placed(count, nullptr);
+    for (size_t k = 0; k < items.size(); k++) {
+        if (items[k].atlas >= 0 && atlas_items[items[k].atlas] >= 2)
+            placed[item_image[k]] = &items[k];
+    }
+
+    // unatlased textures first, in their order, then the atlases
+    std::vector<osg::ref_ptr<osg::Image>> images;
+    std::vector<int> material(count, -1);
+    for (size_t i = 0; i < count; i++) {
+        if (!placed[i]) {
+            material[i] = images.size();
+            images.push_back(build.images[i]);
+        }
+    }
+    std::vector<int> atlas_material(sizes.size(), -1);
+    std::set<int> merged;
+    for (size_t a = 0; a < sizes.size(); a++) {
+        if (atlas_items[a] < 2) continue;
+        osg::ref_ptr<osg::Image> atlas = new osg::Image;
+        atlas->allocateImage(sizes[a].width, sizes[a].height, 1, GL_RGB, GL_UNSIGNED_BYTE);
+        memset(atlas->data(), 0, atlas->getTotalSizeInBytes());
+        atlas_material[a] = images.size();
+        merged.insert(images.size());
+        images.push_back(atlas);
+        build.memory_bytes += atlas->getTotalSizeInBytes();
+    }
+    for (size_t i = 0; i < count; i++) {
+        const AtlasItem* item = placed[i];
+        if (!item) continue;
+        material[i] = atlas_material[item->atlas];
+        osg::Image* atlas = images[material[i]].get();
+        std::vector<unsigned char> pixels;
+        ImageView view = texture_view(build.images[i].get(), max_size, pixels);
+        // a texture that fails to decode stays black, as it would alone
+        if (view.data && view.width == item->width && view.height == item->height) {
+            blit_padded(view, atlas->data(), atlas->s(), atlas->t(), item->x, item->y, atlas_padding);
+        }
+    }
+    for (auto& primitive : build.primitives) {
+        if (primitive.material < 0) continue;
+        const AtlasItem* item = placed[primitive.material];
+        primitive.material = material[primitive.material];
+        if (!item) continue;
+        float atlas_w = (float)images[primitive.material]->s();
+        float atlas_h = (float)images[primitive.material]->t();
+        for (size_t i = 0; i < primitive.texcoords.size(); i += 2) {
+            float u = std::min(1.0f, std::max(0.0f, primitive.texcoords[i]));
+            float v = std::min(1.0f, std::max(0.0f, primitive.texcoords[i + 1]));
+            primitive.texcoords[i] = (item->x + u * item->width) / atlas_w;
+            primitive.texcoords[i + 1] = (item->y + v * item->height) / atlas_h;
+        }
+    }
+    build.images.swap(images);
+    merge_primitives(build.primitives, merged);
+}
+
+// store key of img encoded as format: every source byte (mip levels
+// included), the size it is fitted to and the encode settings
+static TextureKey texture_key(osg::Image* img, const char* format, int max_size, const ConversionOptions& options) {
+    TextureHasher hasher;
+    hasher.add(img->data(), img->getTotalSizeInBytesIncludingMipmaps());
+    int fitted_w, fitted_h;
+    fit_texture_size(img->s(), img->t(), max_size, fitted_w, fitted_h);
+    int layout[] = { img->s(), img->t(), (int)img->getPixelFormat(), (int)img->getDataType(),
+                     (int)img->getRowStepInBytes(), fitted_w, fitted_h };
+    hasher.add(layout, sizeof(layout));
+    hasher.add(format, strlen(format));
+    hasher.add_value(options.quality);
+    hasher.add_value(options.jpeg_backend);
+    hasher.add_value(options.jpeg_subsampling);
+    hasher.add_value(options.jpeg_progressive);
+    hasher.add_value(options.jpeg_optimize);
+    hasher.add_value(options.basis_mode);
+    hasher.add_value(options.basis_quality);
+    return hasher.key();
+}
+
+// Image of img encoded by encode, through the conversion-wide texture
+// store when there is one: an image an earlier tile encoded is reused,
+// either as a reference to its shared file or embedded again.
+// -1 if encode fails.
+static int add_encoded_image(TileBuild& build, const ConversionContext& ctx, osg::Image* img, const char* format,
+                             int max_size, const char* mime, const TextureStore::Encoder& encode,
+                             bool* mipmapped = nullptr) {
+    tinygltf::Model& model = build.model;
+    tinygltf::Buffer& buffer = build.buffer;
+    TextureStore* store = ctx.textures;
+    // shared files are referenced relative to the tile
+    if (!img || (store && store->shared() && build.out_path.empty())) store = nullptr;
+    std::shared_ptr<const EncodedImage> image;
+    if (store) {
+        image = store->get(texture_key(img, format, max_size, ctx.options), mime, encode);
+    }
+    else {
+        auto fresh = std::make_shared<EncodedImage>();
+        fresh->mime = mime;
+        fresh->ok = encode(*fresh);
+        image = fresh;
+    }
+    if (!image->ok) {
+        return -1;
+    }
+    if (mipmapped) *mipmapped = image->mipmapped;
+    if (!image->file.empty()) {
+        std::filesystem::path tile_dir = std::filesystem::absolute(build.out_path).lexically_normal();
+        tinygltf::Image uri_image;
+        uri_image.uri = (std::filesystem::path(store->dir()).lexically_relative(tile_dir) / image->file).generic_string();
+        model.images.push_back(uri_image);
+        return model.images.size() - 1;
+    }
+    size_t buffer_start = buffer.data.size();
+    buffer.data.insert(buffer.data.end(), image->data.begin(), image->data.end());
+    return add_buffer_image(model, buffer, buffer_start, mime);
+}
+
+// {"<extension>":{"source":N}}, the texture object of an extension image
+static std::string texture_extension(const char* extension, int source) {
+    return std::string("{\"") + extension + "\":{\"source\":" + std::to_string(source) + "}}";
+}
+
+void encode_glb_images(TileBuild& build, const ConversionContext& ctx) {
+    tinygltf::Model& model = build.model;
+    tinygltf::Buffer& buffer = build.buffer;
+    size_t geometry_size = buffer.data.size();
+    size_t raw_peak = 0;
+    std::set<std::string> used_extensions;
+    // coarse tiles are seen from far away, their textures get the smaller limit
+    int max_size = ctx.options.texture_size(get_lvl_num(build.path));
+    if (ctx.options.texture_crop) {
+        crop_textures_to_uv(build, ctx, max_size);
+    }
+    if (ctx.options.texture_atlas) {
+        pack_texture_atlases(build, ctx, max_size);
+    }
+    for (auto& image : build.images)
     {
-        for (auto tex : infoVisitor.texture_array)
-        {
-            unsigned buffer_start = buffer.data.size();
-            std::vector<unsigned char> jpeg_buf;
-            jpeg_buf.reserve(512 * 512 * 3);
-            int width, height, comp;
-            if (tex) {
-                if (tex->getNumImages() > 0) {
-                    osg::Image* img = tex->getImage(0);
-                    if (img) {
-                        width = img->s();
-                        height = img->t();
-                        comp = img->getPixelSizeInBits();
-                        if (comp == 8) comp = 1;
-                        if (comp == 24) comp = 3;
-                        if (comp == 4) {
-                            comp = 3;
-                            fill_4BitImage(jpeg_buf, img, width, height);
-                        }
-                        else
-                        {
-                            unsigned row_step = img->getRowStepInBytes();
-                            unsigned row_size = img->getRowSizeInBytes();
-                            for (size_t i = 0; i < height; i++)
-                            {
-                                jpeg_buf.insert(jpeg_buf.end(),
-                                    img->data() + row_step * i,
-                                    img->data() + row_step * i + row_size);
-                            }
-                        }
-                    }
+        osg::Image* img = image.get();
+        tinygltf::Texture texture;
+        texture.sampler = 0;
+        if (ctx.options.texture_format == TextureFormat::ktx2 && img && is_dxt1(img)) {
+            // the DXT1 blocks go out as they are, no decode and no re-encode
+            bool mipmapped = false;
+            int source = add_encoded_image(build, ctx, img, "ktx2", max_size, "image/ktx2", [&](EncodedImage& image) {
+                return encode_ktx2_passthrough(img, max_size, image);
+            }, &mipmapped);
+            if (source >= 0) {
+                texture.extensions = texture_extension(KTX2_TEXTURE_EXTENSION, source);
+                // compressed levels can't be generated by the viewer
+                if (!mipmapped) texture.sampler = 1;
+                used_extensions.insert(KTX2_TEXTURE_EXTENSION);
+                if (!ctx.options.texture_fallback) {
+                    model.textures.push_back(texture);
+                    continue;
                 }
             }
-            if (!jpeg_buf.empty()) {
-                int buf_size = buffer.data.size();
-                buffer.data.reserve(buffer.data.size() + width * height * comp);
-                stbi_write_jpg_to_func(write_buf, &buffer.data, width, height, comp, jpeg_buf.data(), quality * 100);
-            }
-            else {
-                std::vector<char> v_data;
-                width = height = 256;
-                v_data.resize(width * height * 3);
-                stbi_write_jpg_to_func(write_buf, &buffer.data, width, height, 3, v_data.data(), quality * 100);
+        }
+        TexturePixels pixels{img, max_size};
+        const char* extension = nullptr;
+        int source = -1;
+        if (img && ctx.options.texture_format == TextureFormat::basisu) {
+            extension = "KHR_texture_basisu";
+            BasisOptions options;
+            options.mode = ctx.options.basis_mode;
+            options.quality = ctx.options.basis_quality;
+            source = add_encoded_image(build, ctx, img, "basisu", max_size, "image/ktx2", [&](EncodedImage& image) {
+                const ImageView& view = pixels.get();
+                return view.data && encode_basis_ktx2(view, options, image.data);
+            });
+        }
+        else if (img && ctx.options.texture_format == TextureFormat::webp) {
+            extension = "EXT_texture_webp";
+            source = add_encoded_image(build, ctx, img, "webp", max_size, "image/webp", [&](EncodedImage& image) {
+                const ImageView& view = pixels.get();
+                return view.data && encode_webp(view, ctx.options.quality * 100, image.data);
+            });
+        }
+        if (source >= 0) {
+            texture.extensions = texture_extension(extension, source);
+            used_extensions.insert(extension);
+            if (!ctx.options.texture_fallback) {
+                raw_peak = std::max(raw_peak, pixels.pixels.capacity());
+                model.textures.push_back(texture);
+                continue;
             }
-            tinygltf::Image image;
-            image.mimeType = "image/jpeg";
-            image.bufferView = model.bufferViews.size();
-            model.images.push_back(image);
-            tinygltf::BufferView bfv;
-            bfv.buffer = 0;
-            bfv.byteOffset = buffer_start;
-            alignment_buffer(buffer.data);
-            bfv.byteLength = buffer.data.size() - buffer_start;
-            model.bufferViews.push_back(bfv);
         }
+        texture.source = add_encoded_image(build, ctx, img, "jpeg", max_size, "image/jpeg", [&](EncodedImage& image) {
+            return encode_jpeg_or_black(pixels.get(), ctx, image.data);
+        });
+        raw_peak = std::max(raw_peak, pixels.pixels.capacity());
+        model.textures.push_back(texture);
+    }
+    // with a jpeg fallback in every texture the extensions are optional
+    for (auto& extension : used_extensions) {
+        model.extensionsUsed.push_back(extension);
+        if (!ctx.options.texture_fallback)
+            model.extensionsRequired.push_back(extension);
     }
+    // largest decoded image plus the encoded ones
+    build.memory_bytes += raw_peak + (buffer.data.size() - geometry_size);
+}
+
+std::string finish_glb(TileBuild& build, const ConversionContext& ctx) {
+    tinygltf::TinyGLTF gltf;
+    tinygltf::Model& model = build.model;
+    size_t texture_count = build.images.size();
     // node
     {
         tinygltf::Node node;
         node.mesh = 0;
+        node.translation = build.translation;
+        node.scale = build.scale;
         model.nodes.push_back(node);
     }
     // scene
@@ -844,12 +1437,21 @@ bool osgb2glb_buf(std::string path, std::string& glb_buff, MeshInfo& mesh_info)
         sample.wrapS = TINYGLTF_TEXTURE_WRAP_REPEAT;
         sample.wrapT = TINYGLTF_TEXTURE_WRAP_REPEAT;
         model.samplers = { sample };
+        // textures stored without mip levels
+        bool need_linear = false;
+        for (auto& texture : model.textures) {
+            if (texture.sampler == 1) need_linear = true;
+        }
+        if (need_linear) {
+            sample.minFilter = TINYGLTF_TEXTURE_FILTER_LINEAR;
+            model.samplers.push_back(sample);
+        }
     }
     // use pbr material
-    if(b_pbr_texture)
+    if(ctx.options.pbr_texture)
     {
         // std::cout << "use pbr texture" << std::endl;
-        for (int i = 0 ; i < infoVisitor.texture_array.size(); i++)
+        for (int i = 0 ; i < texture_count; i++)
         {
             tinygltf::Material mat = make_color_material_osgb(1.0, 1.0, 1.0);
             tinygltf::Parameter baseColorTexture;
@@ -861,41 +1463,45 @@ bool osgb2glb_buf(std::string path, std::string& glb_buff, MeshInfo& mesh_info)
     // use shader material
     else
     {
-        make_gltf2_shader(model, infoVisitor.texture_array.size(), buffer);
+        make_gltf2_shader(model, texture_count, build.buffer);
     }
     // finish buffer
-    model.buffers.push_back(std::move(buffer));
-    // texture
-    {
-        int texture_index = 0;
-        for (auto tex : infoVisitor.texture_array)
-        {
-            tinygltf::Texture texture;
-            texture.source = texture_index++;
-            texture.sampler = 0;
-            model.textures.push_back(texture);
-        }
+    model.buffers.push_back(std::move(build.buffer));
+    if (build.fallback_bytes) {
+        tinygltf::Buffer fallback;
+        fallback.byteLength = build.fallback_bytes;
+        fallback.extensions = "{\"EXT_meshopt_compression\":{\"fallback\":true}}";
+        model.buffers.push_back(fallback);
     }
+    // textures were added with their images by encode_glb_images
     model.asset.version = "2.0";
     model.asset.generator = "fanvanzh";
 
-    glb_buff = gltf.Serialize(&model);
+    std::string glb = gltf.Serialize(&model);
+    build.memory_bytes += glb.size();
+    return glb;
+}
+
+bool osgb2glb_buf(std::string path, std::string& glb_buff, MeshInfo& mesh_info, const ConversionContext& ctx) {
+    TileBuild build(path);
+    build.root = read_osgb(path);
+    if (!build.root.valid()) {
+        return false;
+    }
+    if (!build_glb_geometry(build, ctx))
+        return false;
+
+    encode_glb_images(build, ctx);
+    encode_glb_geometry(build, ctx);
+    glb_buff = finish_glb(build, ctx);
+    mesh_info = build.mesh_info;
     return true;
 }
 
-bool osgb2b3dm_buf(std::string path, std::string& b3dm_buf, TileBox& tile_box)
+void glb_to_b3dm(const std::string& glb_buf, std::string& b3dm_buf)
 {
     using nlohmann::json;
 
-    std::string glb_buf;
-    MeshInfo minfo;
-    bool ret = osgb2glb_buf(path, glb_buf, minfo);
-    if (!ret)
-        return false;
-
-    tile_box.max = minfo.max;
-    tile_box.min = minfo.min;
-
     int mesh_count = 1;
     std::string feature_json_string;
     feature_json_string += "{\"BATCH_LENGTH\":";
@@ -947,7 +1553,19 @@ bool osgb2b3dm_buf(std::string path, std::string& b3dm_buf, TileBox& tile_box)
     b3dm_buf.append(feature_json_string.begin(),feature_json_string.end());
     b3dm_buf.append(batch_json_string.begin(),batch_json_string.end());
     b3dm_buf.append(glb_buf);
-    return true;
+}
+
+void add_sub_nodes(osg_tree& tree, const InfoVisitor& info) {
+    tree.sub_nodes.resize(info.sub_node_names.size());
+    for (size_t i = 0; i < info.sub_node_names.size(); i++) {
+        tree.sub_nodes[i].file_name = info.sub_node_names[i];
+    }
+}
+
+bool tile_in_range(const osg_tree& tree, const ConversionContext& ctx) {
+    if (tree.file_name.empty()) return false;
+    int lvl = get_lvl_num(tree.file_name);
+    return lvl <= ctx.options.max_lvl;
 }
 
 std::vector<double> convert_bbox(TileBox tile) {
@@ -969,29 +1587,54 @@ std::vector<double> convert_bbox(TileBox tile) {
     return v;
 }
 
-void do_tile_job(osg_tree& tree, std::string out_path, int max_lvl) {
-    std::string json_str;
-    if (tree.file_name.empty()) return;
-    int lvl = get_lvl_num(tree.file_name);
-    if (lvl > max_lvl) return;
-    std::string b3dm_buf;
-    osgb2b3dm_buf(tree.file_name, b3dm_buf, tree.bbox);
+std::string get_b3dm_path(const std::string& out_path, const std::string& file_name) {
     std::string out_file = out_path;
     out_file += "/";
-    out_file += replace(get_file_name(tree.file_name),".osgb",".b3dm");
-    if (!b3dm_buf.empty()) {
-        write_file(out_file.c_str(), b3dm_buf.data(), b3dm_buf.size());
-    }
-    // test
-    // std::string glb_buf;
-    // std::vector<mesh_info> v_info;
-    // osgb2glb_buf(tree.file_name, glb_buf, v_info);
-    // out_file = replace(out_file, ".b3dm", ".glb");
-    // write_file(out_file.c_str(), glb_buf.data(), glb_buf.size());
-    // end test
+    out_file += replace(get_file_name(file_name),".osgb",".b3dm");
+    return out_file;
+}
+
+void do_tile_job(osg_tree& tree, const std::string& out_path, const ConversionContext& ctx) {
+    if (!tile_in_range(tree, ctx)) return;
+    if (ctx.pipeline) {
+        // children are discovered and queued by the pipeline itself
+        TileLatch latch;
+        latch.add();
+        ctx.pipeline->submit(&tree, out_path, &latch);
+        latch.wait();
+        return;
+    }
+    {   // add block to release Node before recursing
+        TileBuild build(tree.file_name);
+        build.out_path = out_path;
+        build.root = read_osgb(tree.file_name);
+        if (!build.root.valid()) {
+            std::string name = utf8_string(tree.file_name.c_str());
+            LOG_E("read node files [%s] fail!", name.c_str());
+            return;
+        }
+        // one parse gives both the glb and the PagedLOD children
+        bool has_mesh = build_glb_geometry(build, ctx);
+        add_sub_nodes(tree, build.info);
+        if (has_mesh) {
+            tree.bbox.max = build.mesh_info.max;
+            tree.bbox.min = build.mesh_info.min;
+            encode_glb_images(build, ctx);
+            encode_glb_geometry(build, ctx);
+            std::string b3dm_buf;
+            glb_to_b3dm(finish_glb(build, ctx), b3dm_buf);
+            std::string out_file = get_b3dm_path(out_path, tree.file_name);
+            write_file(out_file.c_str(), b3dm_buf.data(), b3dm_buf.size());
+        }
+    }
+    // child subtrees are independent, fork them and join before returning
+    TaskGroup group(ctx.pool);
     for (auto& i : tree.sub_nodes) {
-        do_tile_job(i,out_path,max_lvl);
+        group.run([&i, &out_path, &ctx]() {
+            do_tile_job(i, out_path, ctx);
+        });
     }
+    group.wait();
 }
 
 void expend_box(TileBox& box, TileBox& box_new) {
@@ -1127,36 +1770,69 @@ encode_tile_json(osg_tree& tree, double x, double y)
     return tile;
 }
 
+bool tile_tree_json(osg_tree& root, double x, double y, std::string& json, double* box) {
+    extend_tile_box(root);
+    if (root.bbox.max.empty() || root.bbox.min.empty())
+        return false;
+    // prevent for root node disappear
+    calc_geometric_error(root);
+    root.geometricError = 1000.0;
+    json = encode_tile_json(root,x,y);
+    root.bbox.extend(0.2);
+    memcpy(box, root.bbox.max.data(), 3 * sizeof(double));
+    memcpy(box + 3, root.bbox.min.data(), 3 * sizeof(double));
+    return true;
+}
+
+static bool copy_subtree_upto(const osg_tree& tree, int lvl, osg_tree& copy) {
+    int node_lvl = get_lvl_num(tree.file_name);
+    // a child named without _L may be discovered after its level bucket
+    // drained, it is only known to be written once every level is
+    if (node_lvl > lvl || (node_lvl < 0 && lvl != TilePipeline::all_levels))
+        return false;
+    copy.bbox = tree.bbox;
+    copy.geometricError = tree.geometricError;
+    copy.file_name = tree.file_name;
+    for (auto& i : tree.sub_nodes) {
+        osg_tree sub;
+        if (copy_subtree_upto(i, lvl, sub))
+            copy.sub_nodes.push_back(std::move(sub));
+    }
+    return true;
+}
+
+bool copy_tree_upto(const osg_tree& tree, int lvl, osg_tree& copy) {
+    // block roots are all submitted before any level completes, so their
+    // own level, known or not, is accounted for from the start
+    if (get_lvl_num(tree.file_name) > lvl)
+        return false;
+    copy.bbox = tree.bbox;
+    copy.geometricError = tree.geometricError;
+    copy.file_name = tree.file_name;
+    for (auto& i : tree.sub_nodes) {
+        osg_tree sub;
+        if (copy_subtree_upto(i, lvl, sub))
+            copy.sub_nodes.push_back(std::move(sub));
+    }
+    return true;
+}
+
 /***/
 void* 
 osgb23dtile_path(const char* in_path, const char* out_path,
                     double *box, int* len, double x, double y,
-                    int max_lvl, bool pbr_texture, float q)
+                    const ConversionContext& ctx)
 {
-    std::string path = osg_string(in_path);
-    osg_tree root = get_all_tree(path);
-    if (root.file_name.empty())
-    {
-        LOG_E( "open file [%s] fail!", in_path);
-        return NULL;
-    }
-    b_pbr_texture = pbr_texture;
-    quality = q;
-    do_tile_job(root, out_path, max_lvl);
+    osg_tree root;
+    root.file_name = osg_string(in_path);
+    do_tile_job(root, out_path, ctx);
     // return json and max-bbox
-    extend_tile_box(root);
-    if (root.bbox.max.empty() || root.bbox.min.empty())
+    std::string json;
+    if (!tile_tree_json(root, x, y, json, box))
     {
         LOG_E( "[%s] bbox is empty!", in_path);
         return NULL;
     }
-    // prevent for root node disappear
-    calc_geometric_error(root);
-    root.geometricError = 1000.0;
-    std::string json = encode_tile_json(root,x,y);
-    root.bbox.extend(0.2);
-    memcpy(box, root.bbox.max.data(), 3 * sizeof(double));
-    memcpy(box + 3, root.bbox.min.data(), 3 * sizeof(double));
     void* str = malloc(json.length());
     memcpy(str, json.c_str(), json.length());
     *len = json.length();
@@ -1164,13 +1840,12 @@ osgb23dtile_path(const char* in_path, const char* out_path,
 }
 
 bool
-osgb2glb(const char* in, const char* out)
+osgb2glb(const char* in, const char* out, const ConversionContext& ctx)
 {
-    b_pbr_texture = true;
     MeshInfo minfo;
     std::string glb_buf;
     std::string path = osg_string(in);
-    bool ret = osgb2glb_buf(path, glb_buf, minfo);
+    bool ret = osgb2glb_buf(path, glb_buf, minfo, ctx);
     if (!ret)
     {
         LOG_E("convert to glb failed");
@@ -0,0 +1,125 @@
+#include "osgb_index.h"
+
+#include <set>
+#include <algorithm>
+#include <filesystem>
+
+#include <osg/Image>
+#include <osg/PagedLOD>
+#include <osgDB/Options>
+#include <osgDB/ReadFile>
+#include <osgDB/Callbacks>
+
+#include "tileset.h"
+#include "tile_stages.h"
+#include "thread_pool.h"
+
+namespace {
+
+// hands out empty images so external texture files are never opened
+class SkipImageCallback : public osgDB::ReadFileCallback
+{
+public:
+    osgDB::ReaderWriter::ReadResult readImage(const std::string&, const osgDB::Options*) override {
+        return osgDB::ReaderWriter::ReadResult(new osg::Image);
+    }
+};
+
+class IndexVisitor : public osg::NodeVisitor
+{
+    std::string path;
+    std::set<osg::Texture*> textures;
+public:
+    IndexVisitor(std::string _path)
+    :osg::NodeVisitor(TRAVERSE_ALL_CHILDREN)
+    ,path(_path)
+    {}
+
+    void apply(osg::Geometry& geometry) override {
+        auto ss = geometry.getStateSet();
+        if (!ss) return;
+        osg::Texture* tex = dynamic_cast<osg::Texture*>(ss->getTextureAttribute(0, osg::StateAttribute::TEXTURE));
+        if (!tex || !textures.insert(tex).second) return;
+        if (tex->getNumImages() > 0 && tex->getImage(0)) {
+            osg::Image* img = tex->getImage(0);
+            texture_pixels += (uint64_t)img->s() * img->t();
+        }
+    }
+
+    void apply(osg::PagedLOD& node) override {
+        for (unsigned i = 1; i < node.getNumFileNames(); i++)
+        {
+            sub_node_names.push_back(path + "/" + node.getFileName(i));
+            ranges.push_back({node.getMinRange(i), node.getMaxRange(i)});
+        }
+        bound.expandBy(node.getBound());
+        traverse(node);
+    }
+
+public:
+    std::vector<std::string> sub_node_names;
+    std::vector<std::pair<float, float>> ranges;
+    osg::BoundingSphere bound;
+    uint64_t texture_pixels = 0;
+};
+
+osg::ref_ptr<osgDB::Options> scan_options() {
+    osg::ref_ptr<osgDB::Options> options = new osgDB::Options;
+    options->setObjectCacheHint(osgDB::Options::CACHE_NONE);
+    options->setReadFileCallback(new SkipImageCallback);
+    return options;
+}
+
+}
+
+LodNode scan_lod_tree(const std::string& file_name, ThreadPool* pool) {
+    static osg::ref_ptr<osgDB::Options> options = scan_options();
+    LodNode node;
+    IndexVisitor visitor(get_parent(file_name));
+    {   // add block to release Node
+        osg::ref_ptr<osg::Node> root = osgDB::readRefNodeFile(file_name, options.get());
+        if (!root) {
+            std::string name = utf8_string(file_name.c_str());
+            LOG_E("read node files [%s] fail!", name.c_str());
+            return node;
+        }
+        root->accept(visitor);
+    }
+    node.file_name = file_name;
+    node.lvl = get_lvl_num(file_name);
+    std::error_code ec;
+    node.file_size = std::filesystem::file_size(file_name, ec);
+    if (visitor.bound.valid()) {
+        node.center[0] = visitor.bound.center().x();
+        node.center[1] = visitor.bound.center().y();
+        node.center[2] = visitor.bound.center().z();
+        node.radius = visitor.bound.radius();
+    }
+    node.ranges = visitor.ranges;
+    node.texture_pixels = visitor.texture_pixels;
+
+    auto& names = visitor.sub_node_names;
+    node.children.resize(names.size());
+    TaskGroup group(pool);
+    for (size_t i = 0; i < names.size(); i++) {
+        group.run([&node, &names, i, pool]() {
+            node.children[i] = scan_lod_tree(names[i], pool);
+        });
+    }
+    group.wait();
+    node.children.erase(
+        std::remove_if(node.children.begin(), node.children.end(),
+            [](const LodNode& n) { return n.file_name.empty(); }),
+        node.children.end());
+    return node;
+}
+
+void accumulate_lod_stats(const LodNode& node, LodStats& stats) {
+    stats.files++;
+    stats.bytes += node.file_size;
+    stats.texture_pixels += node.texture_pixels;
+    stats.max_lvl = std::max(stats.max_lvl, node.lvl);
+    for (auto& i : node.children) {
+        accumulate_lod_stats(i, stats);
+    }
+}
@@ -0,0 +1,393 @@
+#include "s3tc.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define S3TC_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define S3TC_TARGET(x)
+#else
+#define S3TC_TARGET(x) __attribute__((target(x)))
+#endif
+#endif
+
+namespace {
+
+// color block expansion: 4 rows of 4 RGBA pixels from the 4 entry palette;
+// alpha, when not null, holds the 16 alpha values of the block in raster
+// order and replaces the palette alpha
+typedef void (*ColorKernel)(const uint8_t* color, const uint8_t palette[16], const uint8_t* alpha, uint8_t* out, size_t stride);
+// RGBA rows to RGB
+typedef void (*PackKernel)(const uint8_t* rgba, uint8_t* rgb, size_t pixels);
+
+inline int expand5(int v) { return (v << 3) | (v >> 2); }
+inline int expand6(int v) { return (v << 2) | (v >> 4); }
+
+// palette of a color block as 4 RGBA entries; three_color allows the
+// c0 <= c1 mode of DXT1, DXT3/5 color blocks always have four colors
+inline void block_palette(const uint8_t* color, bool three_color, bool punch_through, uint8_t palette[16]) {
+    int c0 = color[0] | color[1] << 8;
+    int c1 = color[2] | color[3] << 8;
+    int r0 = expand5(c0 >> 11), g0 = expand6((c0 >> 5) & 0x3F), b0 = expand5(c0 & 0x1F);
+    int r1 = expand5(c1 >> 11), g1 = expand6((c1 >> 5) & 0x3F), b1 = expand5(c1 & 0x1F);
+    uint8_t p[16] = {
+        (uint8_t)r0, (uint8_t)g0, (uint8_t)b0, 255,
+        (uint8_t)r1, (uint8_t)g1, (uint8_t)b1, 255,
+    };
+    if (!three_color || c0 > c1) {
+        p[8] = (uint8_t)((2 * r0 + r1) / 3);
+        p[9] = (uint8_t)((2 * g0 + g1) / 3);
+        p[10] = (uint8_t)((2 * b0 + b1) / 3);
+        p[11] = 255;
+        p[12] = (uint8_t)((r0 + 2 * r1) / 3);
+        p[13] = (uint8_t)((g0 + 2 * g1) / 3);
+        p[14] = (uint8_t)((b0 + 2 * b1) / 3);
+        p[15] = 255;
+    }
+    else {
+        p[8] = (uint8_t)((r0 + r1) / 2);
+        p[9] = (uint8_t)((g0 + g1) / 2);
+        p[10] = (uint8_t)((b0 + b1) / 2);
+        p[11] = 255;
+        // black, transparent with punch-through alpha
+        p[12] = p[13] = p[14] = 0;
+        p[15] = punch_through ? 0 : 255;
+    }
+    memcpy(palette, p, 16);
+}
+
+void color_scalar(const uint8_t* color, const uint8_t palette[16], const uint8_t* alpha, uint8_t* out, size_t stride) {
+    for (int row = 0; row < 4; row++) {
+        int bits = color[4 + row];
+        uint8_t* dst = out + row * stride;
+        for (int col = 0; col < 4; col++) {
+            memcpy(dst + 4 * col, palette + 4 * ((bits >> (2 * col)) & 3), 4);
+            if (alpha) dst[4 * col + 3] = alpha[4 * row + col];
+        }
+    }
+}
+
+void pack_scalar(const uint8_t* rgba, uint8_t* rgb, size_t pixels) {
+    for (size_t i = 0; i < pixels; i++) {
+        rgb[3 * i] = rgba[4 * i];
+        rgb[3 * i + 1] = rgba[4 * i + 1];
+        rgb[3 * i + 2] = rgba[4 * i + 2];
+    }
+}
+
+#ifdef S3TC_X86
+// each pixel picks its palette entry with one byte shuffle: the 2 bit index
+// becomes the byte offsets 4i..4i+3 into the palette register. Alpha is
+// merged in the register too, byte stores over the vector stores stall
+// on store forwarding.
+S3TC_TARGET("sse4.1")
+void color_sse41(const uint8_t* color, const uint8_t palette[16], const uint8_t* alpha, uint8_t* out, size_t stride) {
+    const __m128i pal = _mm_loadu_si128((const __m128i*)palette);
+    const __m128i rgb_mask = _mm_set1_epi32(0x00FFFFFF);
+    // alpha byte 4 * row + col to byte 4 * col + 3 of the row
+    const __m128i alpha_row = _mm_setr_epi8(-1, -1, -1, 0, -1, -1, -1, 1, -1, -1, -1, 2, -1, -1, -1, 3);
+    const __m128i alpha_vec = alpha ? _mm_loadu_si128((const __m128i*)alpha) : _mm_setzero_si128();
+    const __m128i lane_shift = _mm_setr_epi32(64, 16, 4, 1);
+    const __m128i three = _mm_set1_epi32(3);
+    const __m128i splat = _mm_set1_epi32(0x04040404);
+    const __m128i bytes = _mm_set1_epi32(0x03020100);
+    for (int row = 0; row < 4; row++) {
+        // (bits << (6 - 2 * col)) >> 6 == (bits >> 2 * col) for an 8 bit row
+        __m128i idx = _mm_mullo_epi32(_mm_set1_epi32(color[4 + row]), lane_shift);
+        idx = _mm_and_si128(_mm_srli_epi32(idx, 6), three);
+        __m128i mask = _mm_add_epi32(_mm_mullo_epi32(idx, splat), bytes);
+        __m128i px = _mm_shuffle_epi8(pal, mask);
+        if (alpha) {
+            __m128i a = _mm_shuffle_epi8(alpha_vec, _mm_add_epi8(alpha_row, _mm_set1_epi32(row * 4 << 24)));
+            px = _mm_or_si128(_mm_and_si128(px, rgb_mask), a);
+        }
+        _mm_storeu_si128((__m128i*)(out + row * stride), px);
+    }
+}
+
+// both 128 bit lanes hold the palette, all 16 pixels take two shuffles
+S3TC_TARGET("avx2")
+void color_avx2(const uint8_t* color, const uint8_t palette[16], const uint8_t* alpha, uint8_t* out, size_t stride) {
+    const __m256i pal = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)palette));
+    uint32_t bits;
+    memcpy(&bits, color + 4, 4);
+    const __m256i all = _mm256_set1_epi32((int)bits);
+    const __m256i three = _mm256_set1_epi32(3);
+    const __m256i splat = _mm256_set1_epi32(0x04040404);
+    const __m256i bytes = _mm256_set1_epi32(0x03020100);
+    __m256i lo = _mm256_srlv_epi32(all, _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14));
+    __m256i hi = _mm256_srlv_epi32(all, _mm256_setr_epi32(16, 18, 20, 22, 24, 26, 28, 30));
+    lo = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_and_si256(lo, three), splat), bytes);
+    hi = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_and_si256(hi, three), splat), bytes);
+    lo = _mm256_shuffle_epi8(pal, lo);
+    hi = _mm256_shuffle_epi8(pal, hi);
+    if (alpha) {
+        // lo holds rows 0 and 1, hi rows 2 and 3, one per 128 bit lane
+        const __m256i a = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)alpha));
+        const __m256i rgb_mask = _mm256_set1_epi32(0x00FFFFFF);
+        const __m256i lo_idx = _mm256_setr_epi8(
+            -1, -1, -1, 0, -1, -1, -1, 1, -1, -1, -1, 2, -1, -1, -1, 3,
+            -1, -1, -1, 4, -1, -1, -1, 5, -1, -1, -1, 6, -1, -1, -1, 7);
+        const __m256i hi_idx = _mm256_setr_epi8(
+            -1, -1, -1, 8, -1, -1, -1, 9, -1, -1, -1, 10, -1, -1, -1, 11,
+            -1, -1, -1, 12, -1, -1, -1, 13, -1, -1, -1, 14, -1, -1, -1, 15);
+        lo = _mm256_or_si256(_mm256_and_si256(lo, rgb_mask), _mm256_shuffle_epi8(a, lo_idx));
+        hi = _mm256_or_si256(_mm256_and_si256(hi, rgb_mask), _mm256_shuffle_epi8(a, hi_idx));
+    }
+    _mm_storeu_si128((__m128i*)out, _mm256_castsi256_si128(lo));
+    _mm_storeu_si128((__m128i*)(out + stride), _mm256_extracti128_si256(lo, 1));
+    _mm_storeu_si128((__m128i*)(out + 2 * stride), _mm256_castsi256_si128(hi));
+    _mm_storeu_si128((__m128i*)(out + 3 * stride), _mm256_extracti128_si256(hi, 1));
+}
+
+// 4 RGBA pixels to 12 RGB bytes per shuffle, the 16 byte stores overlap
+S3TC_TARGET("sse4.1")
+void pack_sse41(const uint8_t* rgba, uint8_t* rgb, size_t pixels) {
+    const __m128i mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    size_t i = 0;
+    // the last store writes 4 bytes past its 12, keep it inside the row
+    for (; i + 6 <= pixels; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(rgba + 4 * i));
+        _mm_storeu_si128((__m128i*)(rgb + 3 * i), _mm_shuffle_epi8(v, mask));
+    }
+    pack_scalar(rgba + 4 * i, rgb + 3 * i, pixels - i);
+}
+
+bool cpu_has(S3tcKernel kernel) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    bool sse41 = (info[2] & (1 << 19)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (kernel == S3tcKernel::sse41) return sse41;
+    if (!osxsave || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    if (kernel == S3tcKernel::sse41) return __builtin_cpu_supports("sse4.1");
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+// DXT3: 16 explicit 4 bit values, out gets them in raster order
+void alpha_dxt3(const uint8_t* block, uint8_t out[16]) {
+    for (int i = 0; i < 8; i++) {
+        out[2 * i] = (uint8_t)((block[i] & 0xF) * 17);
+        out[2 * i + 1] = (uint8_t)((block[i] >> 4) * 17);
+    }
+}
+
+// DXT5: two endpoints and 3 bit indices into an 8 entry ramp
+void alpha_dxt5(const uint8_t* block, uint8_t out[16]) {
+    int a0 = block[0], a1 = block[1];
+    uint8_t ramp[8] = { (uint8_t)a0, (uint8_t)a1 };
+    if (a0 > a1) {
+        for (int i = 1; i < 7; i++)
+            ramp[i + 1] = (uint8_t)(((7 - i) * a0 + i * a1) / 7);
+    }
+    else {
+        for (int i = 1; i < 5; i++)
+            ramp[i + 1] = (uint8_t)(((5 - i) * a0 + i * a1) / 5);
+        ramp[6] = 0;
+        ramp[7] = 255;
+    }
+    uint64_t bits = 0;
+    for (int i = 0; i < 6; i++)
+        bits |= (uint64_t)block[2 + i] << (8 * i);
+    for (int i = 0; i < 16; i++) {
+        out[i] = ramp[(bits >> (3 * i)) & 7];
+    }
+}
+
+inline int bit_count(uint32_t v) {
+    v = v - ((v >> 1) & 0x55555555);
+    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+    return (int)((((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
+}
+
+// RGBA sums over the 16 texels of a block: palette entries weighted by how
+// many indices select them
+inline void block_sums(const uint8_t* block, S3tcFormat format, uint32_t sums[4]) {
+    const uint8_t* color = block + s3tc_block_size(format) - 8;
+    int c0 = color[0] | color[1] << 8;
+    int c1 = color[2] | color[3] << 8;
+    uint32_t bits = color[4] | color[5] << 8 | color[6] << 16 | (uint32_t)color[7] << 24;
+    uint32_t lo = bits & 0x55555555;
+    uint32_t hi = (bits >> 1) & 0x55555555;
+    int n3 = bit_count(lo & hi);
+    int n2 = bit_count(hi & ~lo);
+    int n1 = bit_count(lo & ~hi);
+    int n0 = 16 - n1 - n2 - n3;
+    int e0[3] = { expand5(c0 >> 11), expand6((c0 >> 5) & 0x3F), expand5(c0 & 0x1F) };
+    int e1[3] = { expand5(c1 >> 11), expand6((c1 >> 5) & 0x3F), expand5(c1 & 0x1F) };
+    bool three_color = (format == S3tcFormat::dxt1 || format == S3tcFormat::dxt1a) && c0 <= c1;
+    // same rounding as block_palette, so the result equals a box filter
+    // over the decoded texels
+    // both modes are computed and selected by mask, c0 <= c1 is data
+    // dependent and mispredicts badly
+    int four = three_color ? 0 : -1;
+    for (int c = 0; c < 3; c++) {
+        int half = (e0[c] + e1[c]) >> 1;
+        int p2 = (((2 * e0[c] + e1[c]) * 0xAAAB) >> 17 & four) | (half & ~four);
+        int p3 = ((e0[c] + 2 * e1[c]) * 0xAAAB) >> 17 & four;
+        sums[c] = n0 * e0[c] + n1 * e1[c] + n2 * p2 + n3 * p3;
+    }
+    sums[3] = (format == S3tcFormat::dxt1a && three_color) ? 255 * (16 - n3) : 255 * 16;
+    if (format == S3tcFormat::dxt3 || format == S3tcFormat::dxt5) {
+        uint8_t alpha[16];
+        if (format == S3tcFormat::dxt3)
+            alpha_dxt3(block, alpha);
+        else
+            alpha_dxt5(block, alpha);
+        sums[3] = 0;
+        for (int i = 0; i < 16; i++) sums[3] += alpha[i];
+    }
+}
+}
+
+bool s3tc_kernel_supported(S3tcKernel kernel) {
+    switch (kernel) {
+    case S3tcKernel::automatic:
+    case S3tcKernel::scalar:
+        return true;
+#ifdef S3TC_X86
+    case S3tcKernel::sse41:
+    case S3tcKernel::avx2:
+        return cpu_has(kernel);
+#endif
+    default:
+        return false;
+    }
+}
+
+S3tcKernel s3tc_best_kernel() {
+    static const S3tcKernel best =
+        s3tc_kernel_supported(S3tcKernel::avx2) ? S3tcKernel::avx2 :
+        s3tc_kernel_supported(S3tcKernel::sse41) ? S3tcKernel::sse41 :
+        S3tcKernel::scalar;
+    return best;
+}
+
+bool s3tc_decode(S3tcFormat format, const unsigned char* data, size_t size,
+                 int width, int height, unsigned char* out, int comp,
+                 S3tcKernel kernel) {
+    if (width <= 0 || height <= 0 || (comp != 3 && comp != 4)) {
+        return false;
+    }
+    size_t block_size = s3tc_block_size(format);
+    size_t blocks_x = (width + 3) / 4;
+    size_t blocks_y = (height + 3) / 4;
+    if (size < blocks_x * blocks_y * block_size) {
+        return false;
+    }
+    if (kernel == S3tcKernel::automatic || !s3tc_kernel_supported(kernel)) {
+        kernel = s3tc_best_kernel();
+    }
+    ColorKernel color_kernel = color_scalar;
+    PackKernel pack_kernel = pack_scalar;
+#ifdef S3TC_X86
+    if (kernel == S3tcKernel::avx2) {
+        color_kernel = color_avx2;
+        pack_kernel = pack_sse41;
+    }
+    else if (kernel == S3tcKernel::sse41) {
+        color_kernel = color_sse41;
+        pack_kernel = pack_sse41;
+    }
+#endif
+
+    bool three_color = format == S3tcFormat::dxt1 || format == S3tcFormat::dxt1a;
+    bool punch_through = format == S3tcFormat::dxt1a;
+    size_t color_offset = block_size - 8;
+    bool with_alpha = comp == 4 && (format == S3tcFormat::dxt3 || format == S3tcFormat::dxt5);
+    // RGBA output of whole blocks goes straight into out, anything else
+    // through one row of blocks
+    bool direct = comp == 4 && width % 4 == 0;
+    size_t stride = blocks_x * 16;
+    std::vector<uint8_t> scratch;
+
+    for (size_t by = 0; by < blocks_y; by++) {
+        int rows = std::min(4, height - (int)by * 4);
+        bool in_place = direct && rows == 4;
+        if (!in_place && scratch.empty()) {
+            scratch.resize(stride * 4);
+        }
+        uint8_t* row_buf = in_place ? out + by * 4 * stride : scratch.data();
+        const uint8_t* block = data + by * blocks_x * block_size;
+        for (size_t bx = 0; bx < blocks_x; bx++, block += block_size) {
+            uint8_t palette[16];
+            uint8_t alpha[16];
+            block_palette(block + color_offset, three_color, punch_through, palette);
+            if (with_alpha) {
+                if (format == S3tcFormat::dxt3)
+                    alpha_dxt3(block, alpha);
+                else
+                    alpha_dxt5(block, alpha);
+            }
+            color_kernel(block + color_offset, palette, with_alpha ? alpha : nullptr, row_buf + bx * 16, stride);
+        }
+        if (in_place) {
+            continue;
+        }
+        for (int r = 0; r < rows; r++) {
+            uint8_t* out_row = out + ((size_t)by * 4 + r) * width * comp;
+            if (comp == 3)
+                pack_kernel(row_buf + r * stride, out_row, width);
+            else
+                memcpy(out_row, row_buf + r * stride, (size_t)width * 4);
+        }
+    }
+    return true;
+}
+
+bool s3tc_decode_reduced(S3tcFormat format, const unsigned char* data, size_t size,
+                         int width, int height, int factor, unsigned char* out, int comp) {
+    if (factor < 4 || factor % 4 || factor >= 256 || (comp != 3 && comp != 4)) {
+        return false;
+    }
+    int out_w = width / factor;
+    int out_h = height / factor;
+    size_t block_size = s3tc_block_size(format);
+    size_t blocks_x = (width + 3) / 4;
+    size_t blocks_y = (height + 3) / 4;
+    if (out_w <= 0 || out_h <= 0 || size < blocks_x * blocks_y * block_size) {
+        return false;
+    }
+    int span = factor / 4;      // blocks per output pixel along each axis
+    uint32_t count = (uint32_t)factor * factor;
+    // rounded division by count as a multiply, exact while sums stay
+    // below 2^40 / count (factor < 256)
+    uint64_t inverse = ((uint64_t(1) << 40) + count - 1) / count;
+    std::vector<uint32_t> sums((size_t)out_w * 4);
+    for (int oy = 0; oy < out_h; oy++) {
+        std::fill(sums.begin(), sums.end(), 0);
+        for (int by = oy * span; by < (oy + 1) * span; by++) {
+            const uint8_t* block = data + by * blocks_x * block_size;
+            for (int ox = 0; ox < out_w; ox++) {
+                uint32_t* dst = &sums[ox * 4];
+                for (int i = 0; i < span; i++, block += block_size) {
+                    uint32_t block_sum[4];
+                    block_sums(block, format, block_sum);
+                    dst[0] += block_sum[0];
+                    dst[1] += block_sum[1];
+                    dst[2] += block_sum[2];
+                    dst[3] += block_sum[3];
+                }
+            }
+        }
+        uint8_t* row = out + (size_t)oy * out_w * comp;
+        for (int ox = 0; ox < out_w; ox++) {
+            for (int c = 0; c < comp; c++) {
+                row[ox * comp + c] = (uint8_t)(((sums[ox * 4 + c] + count / 2) * inverse) >> 40);
+            }
+        }
+    }
+    return true;
+}
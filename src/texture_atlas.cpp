@@ -0,0 +1,107 @@
+#include "texture_atlas.h"
+
+#include <numeric>
+#include <algorithm>
+
+namespace {
+
+struct Shelf {
+    int y;
+    int height;
+    int x;          // next free column
+};
+
+struct Atlas {
+    std::vector<Shelf> shelves;
+    int height = 0;     // used rows
+    int width = 0;      // used columns
+};
+
+bool place(Atlas& atlas, int w, int h, int max_size, int& x, int& y) {
+    for (auto& shelf : atlas.shelves) {
+        if (shelf.height >= h && shelf.x + w <= max_size) {
+            x = shelf.x;
+            y = shelf.y;
+            shelf.x += w;
+            atlas.width = std::max(atlas.width, shelf.x);
+            return true;
+        }
+    }
+    if (atlas.height + h > max_size || w > max_size) {
+        return false;
+    }
+    atlas.shelves.push_back(Shelf{atlas.height, h, w});
+    x = 0;
+    y = atlas.height;
+    atlas.height += h;
+    atlas.width = std::max(atlas.width, w);
+    return true;
+}
+
+int pot_size(int size, int max_size) {
+    int pot = 1;
+    while (pot < size) pot *= 2;
+    return pot <= max_size ? pot : size;
+}
+
+}
+
+std::vector<AtlasSize> pack_atlases(std::vector<AtlasItem>& items, int max_size, int padding, int max_atlases) {
+    std::vector<size_t> order(items.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (items[a].height != items[b].height) return items[a].height > items[b].height;
+        return items[a].width > items[b].width;
+    });
+    std::vector<Atlas> atlases;
+    for (size_t i : order) {
+        AtlasItem& item = items[i];
+        int w = item.width + 2 * padding;
+        int h = item.height + 2 * padding;
+        item.atlas = -1;
+        for (size_t a = 0; a <= atlases.size() && a < (size_t)max_atlases; a++) {
+            if (a == atlases.size()) atlases.emplace_back();
+            int x, y;
+            if (place(atlases[a], w, h, max_size, x, y)) {
+                item.atlas = (int)a;
+                item.x = x + padding;
+                item.y = y + padding;
+                break;
+            }
+            if (atlases[a].shelves.empty()) {
+                // too large for an empty atlas, for any other one too
+                atlases.pop_back();
+                break;
+            }
+        }
+    }
+    std::vector<AtlasSize> sizes;
+    for (auto& atlas : atlases) {
+        sizes.push_back(AtlasSize{pot_size(atlas.width, max_size), pot_size(atlas.height, max_size)});
+    }
+    return sizes;
+}
+
+void blit_padded(const ImageView& src, unsigned char* atlas, int atlas_width, int atlas_height,
+                 int x, int y, int padding) {
+    for (int row = -padding; row < src.height + padding; row++) {
+        int dy = y + row;
+        if (dy < 0 || dy >= atlas_height) continue;
+        const unsigned char* src_row = src.data + std::min(std::max(row, 0), src.height - 1) * src.stride;
+        unsigned char* dst_row = atlas + (size_t)dy * atlas_width * 3;
+        for (int col = -padding; col < src.width + padding; col++) {
+            int dx = x + col;
+            if (dx < 0 || dx >= atlas_width) continue;
+            const unsigned char* p = src_row + std::min(std::max(col, 0), src.width - 1) * src.comp;
+            unsigned char* d = dst_row + dx * 3;
+            if (src.comp >= 3) {
+                d[0] = p[0];
+                d[1] = p[1];
+                d[2] = p[2];
+            }
+            else {
+                d[0] = d[1] = d[2] = p[0];
+            }
+        }
+    }
+}
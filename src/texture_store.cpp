@@ -0,0 +1,142 @@
+#include "texture_store.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include "tileset.h"
+
+static uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xFF51AFD7ED558CCDull;
+    k ^= k >> 33;
+    k *= 0xC4CEB9FE1A85EC53ull;
+    k ^= k >> 33;
+    return k;
+}
+
+static uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+std::string TextureKey::hex() const {
+    char buf[33];
+    snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long)hi, (unsigned long long)lo);
+    return buf;
+}
+
+void TextureHasher::mix(uint64_t word) {
+    // two independent lanes, 8 bytes per multiply each
+    a_ = rotl(a_ ^ (word * 0x87C37B91114253D5ull), 31) * 0x4CF5AD432745937Full;
+    b_ = rotl(b_ + word, 27) * 0x9E3779B97F4A7C15ull + 0x52DCE729;
+}
+
+void TextureHasher::add(const void* data, size_t size) {
+    const unsigned char* p = (const unsigned char*)data;
+    size_ += size;
+    for (; size >= 8; p += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        mix(word);
+    }
+    if (size) {
+        uint64_t word = 0;
+        memcpy(&word, p, size);
+        mix(word ^ ((uint64_t)size << 56));
+    }
+}
+
+TextureKey TextureHasher::key() const {
+    TextureKey key;
+    key.lo = fmix64(a_ ^ size_);
+    key.hi = fmix64(b_ ^ rotl(size_, 32) ^ key.lo);
+    return key;
+}
+
+TextureStore::TextureStore(const std::string& shared_dir, uint64_t cache_bytes)
+    : cache_bytes_(cache_bytes)
+{
+    if (!shared_dir.empty()) {
+        std::error_code ec;
+        std::filesystem::create_directories(shared_dir, ec);
+        dir_ = std::filesystem::absolute(shared_dir).lexically_normal().generic_string();
+    }
+}
+
+static const char* mime_extension(const std::string& mime) {
+    if (mime == "image/jpeg") return ".jpg";
+    if (mime == "image/webp") return ".webp";
+    if (mime == "image/ktx2") return ".ktx2";
+    return ".bin";
+}
+
+void TextureStore::write_shared(const TextureKey& key, EncodedImage& image) {
+    std::string name = key.hex() + mime_extension(image.mime);
+    std::string path = dir_ + "/" + name;
+    if (!write_file(path.c_str(), (const char*)image.data.data(), image.data.size())) {
+        // keep the bytes, the tiles embed them instead
+        return;
+    }
+    image.file = name;
+    std::vector<unsigned char>().swap(image.data);
+}
+
+std::shared_ptr<const EncodedImage> TextureStore::get(const TextureKey& key, const std::string& mime, const Encoder& encode) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = slots_.find(key);
+    if (it != slots_.end()) {
+        reused_++;
+        if (it->second.ready) {
+            lru_.splice(lru_.begin(), lru_, it->second.lru);
+        }
+        Result result = it->second.result;
+        lock.unlock();
+        return result.get();
+    }
+    encoded_++;
+    std::promise<std::shared_ptr<const EncodedImage>> promise;
+    it = slots_.emplace(key, Slot()).first;
+    it->second.result = promise.get_future().share();
+    lock.unlock();
+
+    auto image = std::make_shared<EncodedImage>();
+    image->mime = mime;
+    try {
+        image->ok = encode(*image);
+    }
+    catch (...) {
+        // waiters get the exception too, the slot is retried by the next caller
+        promise.set_exception(std::current_exception());
+        lock.lock();
+        slots_.erase(it);
+        throw;
+    }
+    if (image->ok && shared()) {
+        write_shared(key, *image);
+    }
+    promise.set_value(image);
+
+    lock.lock();
+    it->second.ready = true;
+    it->second.bytes = image->data.capacity();
+    it->second.lru = lru_.insert(lru_.begin(), key);
+    held_bytes_ += it->second.bytes;
+    // the new image too: with cache_bytes 0 nothing embedded is kept
+    while (held_bytes_ > cache_bytes_ && !lru_.empty()) {
+        auto last = slots_.find(lru_.back());
+        held_bytes_ -= last->second.bytes;
+        lru_.pop_back();
+        slots_.erase(last);
+    }
+    return image;
+}
+
+uint64_t TextureStore::encoded() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return encoded_;
+}
+
+uint64_t TextureStore::reused() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return reused_;
+}
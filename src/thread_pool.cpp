@@ -0,0 +1,159 @@
+#include "thread_pool.h"
+
+#include <chrono>
+#include <algorithm>
+
+static thread_local ThreadPool* tls_pool = nullptr;
+static thread_local unsigned tls_index = 0;
+
+ThreadPool::ThreadPool(unsigned threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        queues_.push_back(std::make_unique<TaskQueue>());
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        workers_.emplace_back([this, i]() { worker_loop(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : workers_) {
+        t.join();
+    }
+}
+
+void ThreadPool::post(std::function<void()> task) {
+    unsigned index = tls_index;
+    {
+        // count before publishing so a worker never sees a task it can't account for
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_++;
+        if (tls_pool != this) {
+            index = next_queue_++ % queues_.size();
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+        queues_[index]->tasks.push_back(std::move(task));
+    }
+    cv_.notify_one();
+}
+
+bool ThreadPool::try_pop(unsigned index, std::function<void()>& task) {
+    // own queue first, newest task (best cache locality)
+    {
+        TaskQueue& q = *queues_[index];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+        }
+    }
+    // steal the oldest task of another worker
+    for (size_t i = 1; !task && i < queues_.size(); i++) {
+        TaskQueue& q = *queues_[(index + i) % queues_.size()];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+        }
+    }
+    if (!task) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_--;
+    return true;
+}
+
+bool ThreadPool::run_pending_task() {
+    std::function<void()> task;
+    unsigned index = (tls_pool == this) ? tls_index : 0;
+    if (!try_pop(index, task)) {
+        return false;
+    }
+    task();
+    return true;
+}
+
+void ThreadPool::worker_loop(unsigned index) {
+    tls_pool = this;
+    tls_index = index;
+    while (true) {
+        std::function<void()> task;
+        if (try_pop(index, task)) {
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return stop_ || pending_ > 0; });
+        if (stop_ && pending_ == 0) {
+            return;
+        }
+    }
+}
+
+TaskGroup::~TaskGroup() {
+    try {
+        wait();
+    }
+    catch (...) {
+    }
+}
+
+void TaskGroup::run(std::function<void()> task) {
+    if (!pool_) {
+        try {
+            task();
+        }
+        catch (...) {
+            if (!error_) error_ = std::current_exception();
+        }
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        active_++;
+    }
+    pool_->post([this, task = std::move(task)]() {
+        std::exception_ptr err;
+        try {
+            task();
+        }
+        catch (...) {
+            err = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (err && !error_) error_ = err;
+        if (--active_ == 0) {
+            cv_.notify_all();
+        }
+    });
+}
+
+void TaskGroup::wait() {
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (active_ == 0) break;
+        }
+        // help the pool instead of blocking a worker
+        if (pool_->run_pending_task()) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait_for(lock, std::chrono::milliseconds(1), [this]() { return active_ == 0; });
+    }
+    if (error_) {
+        std::exception_ptr err = error_;
+        error_ = nullptr;
+        std::rethrow_exception(err);
+    }
+}
@@ -0,0 +1,36 @@
+#include "tile_mesh.h"
+
+#include <map>
+#include <tuple>
+
+size_t merge_primitives(std::vector<MeshPrimitive>& primitives, const std::set<int>& materials) {
+    std::map<std::tuple<int, bool, bool>, size_t> first;
+    std::vector<MeshPrimitive> merged;
+    merged.reserve(primitives.size());
+    for (auto& primitive : primitives) {
+        if (!materials.count(primitive.material)) {
+            merged.push_back(std::move(primitive));
+            continue;
+        }
+        primitive.draw_ends.clear();
+        auto key = std::make_tuple(primitive.material, !primitive.normals.empty(), !primitive.texcoords.empty());
+        auto it = first.find(key);
+        if (it == first.end()) {
+            first[key] = merged.size();
+            merged.push_back(std::move(primitive));
+            continue;
+        }
+        MeshPrimitive& dst = merged[it->second];
+        uint32_t base = (uint32_t)dst.vertex_count();
+        dst.positions.insert(dst.positions.end(), primitive.positions.begin(), primitive.positions.end());
+        dst.normals.insert(dst.normals.end(), primitive.normals.begin(), primitive.normals.end());
+        dst.texcoords.insert(dst.texcoords.end(), primitive.texcoords.begin(), primitive.texcoords.end());
+        dst.indices.reserve(dst.indices.size() + primitive.indices.size());
+        for (uint32_t index : primitive.indices) {
+            dst.indices.push_back(base + index);
+        }
+    }
+    size_t removed = primitives.size() - merged.size();
+    primitives.swap(merged);
+    return removed;
+}
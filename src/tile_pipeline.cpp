@@ -0,0 +1,245 @@
+#include "tile_pipeline.h"
+
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+
+#include "tileset.h"
+#include "tile_stages.h"
+
+struct TilePipeline::Job {
+    osg_tree* tree;
+    std::string out_path;
+    TileLatch* latch;
+    std::unique_ptr<TileBuild> build;
+    std::string b3dm;
+    uint64_t file_size = 0;
+    uint64_t reserved = 0;          // bytes held in the memory budget
+    int lvl = -1;
+    unsigned rank = 0;              // block order within a level
+    uint64_t seq = 0;               // submit order, ties within a block
+};
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool TilePipeline::JobOrder::operator()(const JobPtr& a, const JobPtr& b) const {
+    // priority_queue pops the largest: deeper levels, then later submits, are smaller
+    if (a->lvl != b->lvl) return a->lvl > b->lvl;
+    if (a->rank != b->rank) return a->rank > b->rank;
+    return a->seq > b->seq;
+}
+
+// peak bytes per osgb byte assumed before any run measured it: DXT1
+// textures grow 6x once expanded to RGB, geometry about 2x
+static const double default_memory_ratio = 8.0;
+
+PipelineOptions PipelineOptions::resolved(unsigned jobs) const {
+    jobs = std::max(1u, jobs);
+    PipelineOptions opts = *this;
+    if (!opts.read_threads) opts.read_threads = std::max(2u, jobs / 4);
+    if (!opts.build_threads) opts.build_threads = jobs;
+    if (!opts.encode_threads) opts.encode_threads = jobs;
+    if (!opts.write_threads) opts.write_threads = std::max(1u, jobs / 8);
+    if (!opts.io_depth) opts.io_depth = 64;
+    if (!opts.queue_depth) opts.queue_depth = 2 * jobs;
+    return opts;
+}
+
+void TileLatch::add(size_t n) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    count_ += n;
+}
+
+void TileLatch::done() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--count_ == 0) {
+        cv_.notify_all();
+    }
+}
+
+void TileLatch::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return count_ == 0; });
+}
+
+void TileLatch::add_time(double seconds) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    seconds_ += seconds;
+}
+
+double TileLatch::seconds() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return seconds_;
+}
+
+TilePipeline::TilePipeline(const PipelineOptions& options, const ConversionContext& ctx)
+    : ctx_(ctx)
+    , budget_(options.memory_budget)
+    , read_ratio_(options.memory_ratio > 0 ? options.memory_ratio : default_memory_ratio)
+    , build_queue_(options.queue_depth)
+    , encode_queue_(options.queue_depth)
+{
+    WriterOptions writer_options;
+    writer_options.threads = std::max(1u, options.write_threads);
+    writer_options.queue_depth = std::max(1u, options.io_depth);
+    writer_ = make_tile_writer(writer_options);
+
+    for (unsigned i = 0; i < std::max(1u, options.read_threads); i++)
+        read_threads_.emplace_back(&TilePipeline::read_loop, this);
+    for (unsigned i = 0; i < std::max(1u, options.build_threads); i++)
+        build_threads_.emplace_back(&TilePipeline::build_loop, this);
+    for (unsigned i = 0; i < std::max(1u, options.encode_threads); i++)
+        encode_threads_.emplace_back(&TilePipeline::encode_loop, this);
+}
+
+TilePipeline::~TilePipeline() {
+    // shut down front to back so every stage drains into the next one
+    read_queue_.close();
+    for (auto& t : read_threads_) t.join();
+    build_queue_.close();
+    for (auto& t : build_threads_) t.join();
+    encode_queue_.close();
+    for (auto& t : encode_threads_) t.join();
+    writer_.reset();
+}
+
+void TilePipeline::submit(osg_tree* tree, const std::string& out_path, TileLatch* latch, unsigned rank) {
+    JobPtr job(new Job{tree, out_path, latch, nullptr, std::string()});
+    job->lvl = get_lvl_num(tree->file_name);
+    job->rank = rank;
+    {
+        std::lock_guard<std::mutex> lock(level_mutex_);
+        levels_[job->lvl]++;
+        job->seq = next_seq_++;
+    }
+    read_queue_.push(std::move(job));
+}
+
+void TilePipeline::read_loop() {
+    JobPtr job;
+    while (read_queue_.pop(job)) {
+        std::error_code ec;
+        job->file_size = std::filesystem::file_size(job->tree->file_name, ec);
+        if (ec) job->file_size = 0;
+        // admission: wait until the tile's first estimate fits the budget
+        job->reserved = (uint64_t)(job->file_size * read_ratio_);
+        budget_.acquire(job->reserved);
+
+        auto start = std::chrono::steady_clock::now();
+        job->build.reset(new TileBuild(job->tree->file_name));
+        job->build->out_path = job->out_path;
+        job->build->root = read_osgb(job->tree->file_name);
+        job->latch->add_time(seconds_since(start));
+        if (!job->build->root.valid()) {
+            std::string name = utf8_string(job->tree->file_name.c_str());
+            LOG_E("read node files [%s] fail!", name.c_str());
+            reserve(*job, 0);
+            tile_done(job->latch, job->lvl);
+            continue;
+        }
+        build_queue_.push(std::move(job));
+    }
+}
+
+void TilePipeline::build_loop() {
+    JobPtr job;
+    while (build_queue_.pop(job)) {
+        auto start = std::chrono::steady_clock::now();
+        bool has_mesh = build_glb_geometry(*job->build, ctx_);
+        job->latch->add_time(seconds_since(start));
+        // the visitor pass above also collected the PagedLOD children, queue
+        // them now so discovery never reads a file twice
+        osg_tree* tree = job->tree;
+        add_sub_nodes(*tree, job->build->info);
+        for (auto& i : tree->sub_nodes) {
+            if (tile_in_range(i, ctx_)) {
+                job->latch->add();
+                submit(&i, job->out_path, job->latch, job->rank);
+            }
+        }
+        if (!has_mesh) {
+            reserve(*job, 0);
+            tile_done(job->latch, job->lvl);
+            continue;
+        }
+        // textures are known now, the RGB copies are still to come
+        reserve(*job, job->build->memory_bytes + job->build->texture_pixels * 3);
+        job->tree->bbox.max = job->build->mesh_info.max;
+        job->tree->bbox.min = job->build->mesh_info.min;
+        encode_queue_.push(std::move(job));
+    }
+}
+
+void TilePipeline::encode_loop() {
+    JobPtr job;
+    while (encode_queue_.pop(job)) {
+        auto start = std::chrono::steady_clock::now();
+        encode_glb_images(*job->build, ctx_);
+        encode_glb_geometry(*job->build, ctx_);
+        std::string glb_buf = finish_glb(*job->build, ctx_);
+        uint64_t peak = job->build->memory_bytes;
+        // the osg scene graph is no longer needed, free it before queuing
+        job->build.reset();
+        glb_to_b3dm(glb_buf, job->b3dm);
+        job->latch->add_time(seconds_since(start));
+        record_peak(*job, peak + job->b3dm.size());
+        reserve(*job, job->b3dm.size());
+        // the writer owns the buffer from here, the latch is released once
+        // the file is on disk
+        std::string out_file = get_b3dm_path(job->out_path, job->tree->file_name);
+        TileLatch* latch = job->latch;
+        uint64_t reserved = job->reserved;
+        int lvl = job->lvl;
+        writer_->write(std::move(out_file), std::move(job->b3dm), [this, latch, reserved, lvl](bool) {
+            budget_.release(reserved);
+            tile_done(latch, lvl);
+        });
+    }
+}
+
+void TilePipeline::tile_done(TileLatch* latch, int lvl) {
+    {
+        std::lock_guard<std::mutex> lock(level_mutex_);
+        auto it = levels_.find(lvl);
+        if (--it->second == 0) {
+            levels_.erase(it);
+            level_cv_.notify_all();
+        }
+    }
+    latch->done();
+}
+
+int TilePipeline::completed_level() const {
+    return levels_.empty() ? all_levels : levels_.begin()->first - 1;
+}
+
+int TilePipeline::wait_level(int after) {
+    std::unique_lock<std::mutex> lock(level_mutex_);
+    level_cv_.wait(lock, [this, after]() { return completed_level() > after; });
+    return completed_level();
+}
+
+void TilePipeline::reserve(Job& job, uint64_t bytes) {
+    budget_.resize(job.reserved, bytes);
+    job.reserved = bytes;
+}
+
+void TilePipeline::record_peak(const Job& job, uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    peak_tile_bytes_ = std::max(peak_tile_bytes_, bytes);
+    if (job.file_size) {
+        memory_ratio_ = std::max(memory_ratio_, (double)bytes / job.file_size);
+    }
+}
+
+double TilePipeline::memory_ratio() {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return memory_ratio_;
+}
+
+uint64_t TilePipeline::peak_tile_bytes() {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return peak_tile_bytes_;
+}
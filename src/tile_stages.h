@@ -0,0 +1,147 @@
+#pragma once
+// Building blocks of a single tile conversion. osgb2glb_buf runs them back
+// to back, the pipelined engine (tile_pipeline.cpp) runs each one on its
+// own stage threads.
+#include <set>
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <osg/Node>
+#include <osg/PagedLOD>
+#include <osg/Geometry>
+#include <osg/Texture>
+
+#include "tiny_gltf.h"
+#include "tile_mesh.h"
+#include "osgb23dtiles.h"
+
+struct TileBox
+{
+    std::vector<double> max;
+    std::vector<double> min;
+
+    void extend(double ratio) {
+        ratio /= 2;
+        double x = max[0] - min[0];
+        double y = max[1] - min[1];
+        double z = max[2] - min[2];
+        max[0] += x * ratio;
+        max[1] += y * ratio;
+        max[2] += z * ratio;
+
+        min[0] -= x * ratio;
+        min[1] -= y * ratio;
+        min[2] -= z * ratio;
+    }
+};
+
+struct osg_tree {
+    TileBox bbox;
+    double geometricError = 0.0;
+    std::string file_name;
+    std::vector<osg_tree> sub_nodes;
+};
+
+class InfoVisitor : public osg::NodeVisitor
+{
+    std::string path;
+public:
+    InfoVisitor(std::string _path)
+    :osg::NodeVisitor(TRAVERSE_ALL_CHILDREN)
+    ,path(_path)
+    {}
+
+    ~InfoVisitor() {
+    }
+
+    void apply(osg::Geometry& geometry){
+        geometry_array.push_back(&geometry);
+        if (auto ss = geometry.getStateSet() ) {
+            osg::Texture* tex = dynamic_cast<osg::Texture*>(ss->getTextureAttribute(0, osg::StateAttribute::TEXTURE));
+            if (tex) {
+                texture_array.insert(tex);
+                texture_map[&geometry] = tex;
+            }
+        }
+    }
+
+    void apply(osg::PagedLOD& node) {
+        //std::string path = node.getDatabasePath();
+        int n = node.getNumFileNames();
+        for (size_t i = 1; i < n; i++)
+        {
+            std::string file_name = path + "/" + node.getFileName(i);
+            sub_node_names.push_back(file_name);
+        }
+        traverse(node);
+    }
+
+public:
+    std::vector<osg::Geometry*> geometry_array;
+    std::set<osg::Texture*> texture_array;
+    std::map<osg::Geometry*, osg::Texture*> texture_map;
+    std::vector<std::string> sub_node_names;
+};
+
+struct MeshInfo
+{
+    std::string name;
+    std::vector<double> min;
+    std::vector<double> max;
+};
+
+
+std::string get_parent(std::string str);
+std::string utf8_string(const char* path);
+int get_lvl_num(std::string file_name);
+std::string get_b3dm_path(const std::string& out_path, const std::string& file_name);
+// false for empty names and levels deeper than options.max_lvl
+bool tile_in_range(const osg_tree& tree, const ConversionContext& ctx);
+// one child node per PagedLOD file name collected by the visitor
+void add_sub_nodes(osg_tree& tree, const InfoVisitor& info);
+// block tileset json of a converted tree, box gets max xyz then min xyz;
+// false when nothing in the tree has a bounding box
+bool tile_tree_json(osg_tree& root, double x, double y, std::string& json, double* box);
+// copy of the nodes at level <= lvl, deeper nodes are never read so the
+// rest of the tree may still be under conversion; below the root a node
+// with no _L level is kept only when lvl is TilePipeline::all_levels
+bool copy_tree_upto(const osg_tree& tree, int lvl, osg_tree& copy);
+
+struct TileBuild
+{
+    std::string path;
+    std::string out_path;           // b3dm directory, shared textures are referenced from it
+    osg::ref_ptr<osg::Node> root;
+    InfoVisitor info;
+    tinygltf::Model model;
+    tinygltf::Buffer buffer;
+    std::vector<MeshPrimitive> primitives;
+    size_t source_primitives = 0;   // as read, before any merge
+    std::vector<osg::ref_ptr<osg::Image>> images;   // texture of material i, may be null
+    MeshInfo mesh_info;
+    std::vector<double> translation;    // node transform of quantized positions, empty without
+    std::vector<double> scale;
+    size_t fallback_bytes = 0;      // geometry moved out to the meshopt fallback buffer
+    uint64_t texture_pixels = 0;    // width * height summed over the textures
+    uint64_t memory_bytes = 0;      // peak bytes held so far, updated by each stage
+
+    explicit TileBuild(const std::string& _path)
+    :path(_path)
+    ,info(get_parent(_path))
+    {}
+};
+
+// read stage: parse the osgb file
+osg::ref_ptr<osg::Node> read_osgb(const std::string& path);
+// build stage: normals, primitives and textures, false if there is nothing to draw
+bool build_glb_geometry(TileBuild& build, const ConversionContext& ctx);
+// texture extension of the DXT1 passthrough, a KTX2 image as "source"
+#define KTX2_TEXTURE_EXTENSION "OSGB2TILES_texture_ktx2"
+
+// encode stage: jpeg/ktx2 textures, geometry accessors, materials and glb serialization
+void encode_glb_images(TileBuild& build, const ConversionContext& ctx);
+void encode_glb_geometry(TileBuild& build, const ConversionContext& ctx);
+std::string finish_glb(TileBuild& build, const ConversionContext& ctx);
+void glb_to_b3dm(const std::string& glb_buf, std::string& b3dm_buf);
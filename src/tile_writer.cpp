@@ -0,0 +1,220 @@
+#include "tile_writer.h"
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include "tileset.h"
+#include "bounded_queue.h"
+
+#ifdef HAVE_LIBURING
+#include <fcntl.h>
+#include <liburing.h>
+#endif
+
+namespace {
+
+struct WriteRequest {
+    std::string path;
+    std::string data;
+    std::function<void(bool)> done;
+};
+
+class ThreadTileWriter : public TileWriter
+{
+public:
+    explicit ThreadTileWriter(const WriterOptions& options)
+    : queue_(std::max(1u, options.queue_depth))
+    {
+        for (unsigned i = 0; i < std::max(1u, options.threads); i++) {
+            threads_.emplace_back([this]() {
+                WriteRequest req;
+                while (queue_.pop(req)) {
+                    bool ok = write_file(req.path.c_str(), req.data.data(), req.data.size());
+                    if (req.done) req.done(ok);
+                }
+            });
+        }
+    }
+
+    ~ThreadTileWriter() override {
+        queue_.close();
+        for (auto& t : threads_) t.join();
+    }
+
+    void write(std::string path, std::string data, std::function<void(bool)> done) override {
+        queue_.push(WriteRequest{std::move(path), std::move(data), std::move(done)});
+    }
+
+private:
+    BoundedQueue<WriteRequest> queue_;
+    std::vector<std::thread> threads_;
+};
+
+#ifdef HAVE_LIBURING
+// Every file takes three linked SQEs: openat into a fixed-file slot, write
+// from the slot, close the slot. The write is hard-linked to the close so a
+// failed or short write never leaks the slot. A single thread owns the ring.
+class UringTileWriter : public TileWriter
+{
+    struct Request : WriteRequest {
+        unsigned slot = 0;
+        int pending = 0;
+        bool ok = true;
+    };
+    enum Op { OP_OPEN = 0, OP_WRITE = 1, OP_CLOSE = 2 };
+
+public:
+    static std::unique_ptr<TileWriter> create(const WriterOptions& options) {
+        std::unique_ptr<UringTileWriter> writer(new UringTileWriter(std::max(1u, options.queue_depth)));
+        if (!writer->init()) {
+            return nullptr;
+        }
+        writer->thread_ = std::thread(&UringTileWriter::loop, writer.get());
+        return writer;
+    }
+
+    ~UringTileWriter() override {
+        queue_.close();
+        if (thread_.joinable()) thread_.join();
+        if (ring_ready_) io_uring_queue_exit(&ring_);
+    }
+
+    void write(std::string path, std::string data, std::function<void(bool)> done) override {
+        Request* req = new Request;
+        req->path = std::move(path);
+        req->data = std::move(data);
+        req->done = std::move(done);
+        queue_.push(req);
+    }
+
+private:
+    explicit UringTileWriter(unsigned depth)
+    : depth_(depth)
+    , queue_(depth)
+    {}
+
+    bool init() {
+        if (io_uring_queue_init(depth_ * 3, &ring_, 0) < 0) {
+            return false;
+        }
+        ring_ready_ = true;
+        io_uring_probe* probe = io_uring_get_probe_ring(&ring_);
+        if (!probe) {
+            return false;
+        }
+        bool supported = io_uring_opcode_supported(probe, IORING_OP_OPENAT)
+            && io_uring_opcode_supported(probe, IORING_OP_WRITE)
+            && io_uring_opcode_supported(probe, IORING_OP_CLOSE);
+        io_uring_free_probe(probe);
+        if (!supported || io_uring_register_files_sparse(&ring_, depth_) < 0) {
+            return false;
+        }
+        for (unsigned i = 0; i < depth_; i++) {
+            free_slots_.push_back(i);
+        }
+        return true;
+    }
+
+    static void set_data(io_uring_sqe* sqe, Request* req, Op op) {
+        io_uring_sqe_set_data64(sqe, (uint64_t)(uintptr_t)req | op);
+    }
+
+    void prepare(Request* req) {
+        req->slot = free_slots_.back();
+        free_slots_.pop_back();
+        req->pending = 3;
+
+        io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+        io_uring_prep_openat_direct(sqe, AT_FDCWD, req->path.c_str(),
+            O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644, req->slot);
+        sqe->flags |= IOSQE_IO_LINK;
+        set_data(sqe, req, OP_OPEN);
+
+        sqe = io_uring_get_sqe(&ring_);
+        io_uring_prep_write(sqe, req->slot, req->data.data(), req->data.size(), 0);
+        sqe->flags |= IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+        set_data(sqe, req, OP_WRITE);
+
+        sqe = io_uring_get_sqe(&ring_);
+        io_uring_prep_close_direct(sqe, req->slot);
+        set_data(sqe, req, OP_CLOSE);
+    }
+
+    void complete(io_uring_cqe* cqe) {
+        uint64_t data = io_uring_cqe_get_data64(cqe);
+        Request* req = (Request*)(uintptr_t)(data & ~uint64_t(3));
+        Op op = (Op)(data & 3);
+        if (cqe->res < 0 || (op == OP_WRITE && (size_t)cqe->res != req->data.size())) {
+            req->ok = false;
+        }
+        if (--req->pending > 0) {
+            return;
+        }
+        free_slots_.push_back(req->slot);
+        if (!req->ok) {
+            // retry the file synchronously, write_file reports what goes wrong
+            req->ok = write_file(req->path.c_str(), req->data.data(), req->data.size());
+        }
+        if (req->done) req->done(req->ok);
+        delete req;
+    }
+
+    void loop() {
+        unsigned inflight = 0;
+        while (true) {
+            // queue as many files as there are free slots, block only when idle
+            unsigned queued = 0;
+            while (!free_slots_.empty()) {
+                Request* req = nullptr;
+                if (inflight + queued == 0) {
+                    if (!queue_.pop(req)) return;
+                }
+                else if (!queue_.try_pop(req)) {
+                    break;
+                }
+                prepare(req);
+                queued++;
+            }
+            if (queued) {
+                io_uring_submit(&ring_);
+                inflight += queued;
+            }
+
+            io_uring_cqe* cqe = nullptr;
+            if (io_uring_wait_cqe(&ring_, &cqe) < 0) {
+                continue;
+            }
+            unsigned head;
+            unsigned seen = 0;
+            io_uring_for_each_cqe(&ring_, head, cqe) {
+                uint64_t data = io_uring_cqe_get_data64(cqe);
+                Request* req = (Request*)(uintptr_t)(data & ~uint64_t(3));
+                bool last = req->pending == 1;
+                complete(cqe);
+                if (last) inflight--;
+                seen++;
+            }
+            io_uring_cq_advance(&ring_, seen);
+        }
+    }
+
+    unsigned depth_;
+    io_uring ring_;
+    bool ring_ready_ = false;
+    BoundedQueue<Request*> queue_;
+    std::vector<unsigned> free_slots_;
+    std::thread thread_;
+};
+#endif
+
+}
+
+std::unique_ptr<TileWriter> make_tile_writer(const WriterOptions& options) {
+#ifdef HAVE_LIBURING
+    if (auto writer = UringTileWriter::create(options)) {
+        return writer;
+    }
+#endif
+    return std::unique_ptr<TileWriter>(new ThreadTileWriter(options));
+}
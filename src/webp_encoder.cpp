@@ -0,0 +1,55 @@
+#include "webp_encoder.h"
+
+#ifdef HAVE_LIBWEBP
+#include <webp/encode.h>
+
+bool webp_available() {
+    return true;
+}
+
+bool encode_webp(const ImageView& image, float quality, std::vector<unsigned char>& out) {
+    if (image.comp < 1 || image.comp > 4 || image.width <= 0 || image.height <= 0) {
+        return false;
+    }
+    const unsigned char* data = image.data;
+    int stride = (int)image.stride;
+    bool alpha = image.comp == 2 || image.comp == 4;
+    // libwebp reads RGB and RGBA rows in place, gray is expanded first
+    std::vector<unsigned char> expanded;
+    if (image.comp < 3) {
+        int comp = alpha ? 4 : 3;
+        expanded.resize((size_t)image.width * image.height * comp);
+        for (int y = 0; y < image.height; y++) {
+            const unsigned char* src = image.data + y * image.stride;
+            unsigned char* dst = &expanded[(size_t)y * image.width * comp];
+            for (int x = 0; x < image.width; x++, dst += comp, src += image.comp) {
+                dst[0] = dst[1] = dst[2] = src[0];
+                if (alpha) dst[3] = src[1];
+            }
+        }
+        data = expanded.data();
+        stride = image.width * comp;
+    }
+    uint8_t* webp = nullptr;
+    size_t size = alpha
+        ? WebPEncodeRGBA(data, image.width, image.height, stride, quality, &webp)
+        : WebPEncodeRGB(data, image.width, image.height, stride, quality, &webp);
+    if (!size) {
+        return false;
+    }
+    out.insert(out.end(), webp, webp + size);
+    WebPFree(webp);
+    return true;
+}
+
+#else
+
+bool webp_available() {
+    return false;
+}
+
+bool encode_webp(const ImageView&, float, std::vector<unsigned char>&) {
+    return false;
+}
+
+#endif